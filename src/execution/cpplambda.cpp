@@ -1,13 +1,24 @@
+#include <cstring>
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
 #include "execution/cpplambda.h"
+#include "execution/shared_region.h"
 
 using namespace simpledb::proto;
 
+/* 1 at the end of the input */
 static inline int parse_args(ExecArgs& args)
 {
     size_t len;
-    std::cin.read((char*) &len, sizeof(size_t));
+    if (!std::cin.read((char*) &len, sizeof(size_t)))
+        return 1;
+
     std::string buf(len, 0);
-    std::cin.read(&buf[0], len);
+    if (!std::cin.read(&buf[0], len))
+        return -1;
 
     if (!args.ParseFromString(buf))
         return -1;
@@ -23,17 +34,180 @@ static inline int return_output(const ExecResponse& resp)
     output.append(resp.SerializeAsString());
 
     std::cout.write(&output[0], output.size());
+    std::cout.flush();
+
+    if (!std::cout)
+        return -1;
 
     return 0;
 }
 
+static int serve_persistent()
+{
+    ExecArgs args;
+    ExecResponse resp;
+
+    while (true)
+    {
+        const int ret = parse_args(args);
+        if (ret > 0)
+            return EXEC_OK;
+        if (ret < 0)
+            return EXEC_INPUT_ERROR;
+
+        try
+        {
+            lambda_exec(args, resp);
+        }
+        catch (std::exception& e)
+        {
+            resp.Clear();
+            resp.set_return_code(EXEC_EXCEPTION);
+            resp.set_return_output(e.what());
+        }
+
+        if (return_output(resp) < 0)
+            return EXEC_OUTPUT_ERROR;
+
+        args.Clear();
+        resp.Clear();
+    }
+}
+
+static int serve_shared()
+{
+    SharedRegion args_region { EXEC_ARGS_FD };
+    SharedRegion resp_region { EXEC_RESPONSE_FD };
+    ExecArgs args;
+    ExecResponse resp;
+
+    size_t len = EXEC_SHARED_MEMORY_HELLO;
+    std::cout.write((char*) &len, sizeof(size_t));
+    std::cout.flush();
+    if (!std::cout)
+        return EXEC_OUTPUT_ERROR;
+
+    while (std::cin.read((char*) &len, sizeof(size_t)))
+    {
+        if (!args.ParseFromArray(args_region.view(len), len))
+            return EXEC_INPUT_ERROR;
+
+        try
+        {
+            lambda_exec(args, resp);
+        }
+        catch (std::exception& e)
+        {
+            resp.Clear();
+            resp.set_return_code(EXEC_EXCEPTION);
+            resp.set_return_output(e.what());
+        }
+
+        len = resp.ByteSizeLong();
+        if (!resp.SerializeToArray(resp_region.reserve(len), len))
+            return EXEC_OUTPUT_ERROR;
+
+        std::cout.write((char*) &len, sizeof(size_t));
+        std::cout.flush();
+        if (!std::cout)
+            return EXEC_OUTPUT_ERROR;
+
+        args.Clear();
+        resp.Clear();
+    }
+
+    return EXEC_OK;
+}
+
+/* Returns in the zygote only when it is done, and in each worker once
+ * that worker is done */
+static int serve_zygote()
+{
+    const int control = 0;
+    signal(SIGCHLD, SIG_IGN);   /* workers are reaped by the kernel */
+
+    while (true)
+    {
+        int fds[EXEC_ZYGOTE_FDS];
+        char request;
+        struct iovec iov { &request, 1 };
+        union
+        {
+            char buf[CMSG_SPACE(sizeof(fds))];
+            struct cmsghdr align;
+        } cmsg_buf;
+
+        struct msghdr msg {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = cmsg_buf.buf;
+        msg.msg_controllen = sizeof(cmsg_buf.buf);
+
+        const ssize_t n = recvmsg(control, &msg, MSG_CMSG_CLOEXEC);
+        if (n == 0)
+            return EXEC_OK;
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        if (n < 0 || cmsg == nullptr || cmsg->cmsg_type != SCM_RIGHTS
+                || cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))
+            return EXEC_INPUT_ERROR;
+        memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+        const pid_t pid = fork();
+        if (pid == 0)
+        {
+            signal(SIGCHLD, SIG_DFL);
+
+            /* Moved clear of the targets first, then into place */
+            const int targets[EXEC_ZYGOTE_FDS] = { 0, 1, EXEC_ARGS_FD, EXEC_RESPONSE_FD };
+            for (int& fd : fds)
+            {
+                const int moved = fcntl(fd, F_DUPFD, EXEC_RESPONSE_FD + 1);
+                close(fd);
+                fd = moved;
+            }
+            for (int idx = 0; idx < EXEC_ZYGOTE_FDS; idx++)
+            {
+                if (fds[idx] < 0 || dup2(fds[idx], targets[idx]) < 0)
+                    return EXEC_INPUT_ERROR;
+                close(fds[idx]);
+            }
+
+            return serve_shared();
+        }
+
+        for (const int fd : fds)
+            close(fd);
+
+        if (write(control, &pid, sizeof(pid_t)) != sizeof(pid_t))
+            return EXEC_OUTPUT_ERROR;
+    }
+}
+
 int main(int argc, char* argv[])
 {
     GOOGLE_PROTOBUF_VERIFY_VERSION;
     ExecArgs args;
     ExecResponse resp;
 
-    if (parse_args(args) < 0)
+    if (argc > 1 && strcmp(argv[1], EXEC_ZYGOTE_FLAG) == 0)
+    {
+        const int ret = serve_zygote();
+        google::protobuf::ShutdownProtobufLibrary();
+        return ret;
+    }
+
+    if (argc > 1 && strcmp(argv[1], EXEC_PERSISTENT_FLAG) == 0)
+    {
+        const bool shared = argc > 2 && strcmp(argv[2], EXEC_SHARED_MEMORY_FLAG) == 0;
+        const int ret = shared ? serve_shared() : serve_persistent();
+        google::protobuf::ShutdownProtobufLibrary();
+        return ret;
+    }
+
+    if (parse_args(args) != 0)
         return EXEC_INPUT_ERROR;
 
     try
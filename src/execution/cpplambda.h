@@ -15,6 +15,41 @@ enum ExecErrorCodes {
     EXEC_OUTPUT_ERROR
 };
 
+/* Started with this argument, a function serves one length-prefixed
+ * ExecArgs after another until stdin is closed, answering each with a
+ * length-prefixed ExecResponse. An exception becomes a response with
+ * return code EXEC_EXCEPTION instead of ending the process. */
+#define EXEC_PERSISTENT_FLAG "--persistent"
+
+/* Given after EXEC_PERSISTENT_FLAG, messages are passed in shared
+ * memory instead: each ExecArgs is read in place from the region on
+ * fd EXEC_ARGS_FD and each ExecResponse written to the region on fd
+ * EXEC_RESPONSE_FD, and the pipes carry only their lengths. Before
+ * anything else the function writes EXEC_SHARED_MEMORY_HELLO as a
+ * size_t, so the server can tell binaries built before this mode,
+ * which ignore the flags and wait for a whole message, from ones that
+ * speak it. */
+#define EXEC_SHARED_MEMORY_FLAG "--shared-memory"
+#define EXEC_SHARED_MEMORY_HELLO    ((size_t) 0x53484d454d303031ULL)
+#define EXEC_ARGS_FD        3
+#define EXEC_RESPONSE_FD    4
+
+/* Started with this argument, a function initializes once and then
+ * forks a worker per request on the control socket at fd 0. Each
+ * request is one byte carrying, as SCM_RIGHTS, the worker's stdin,
+ * stdout and its args and response regions; the worker serves them as
+ * if started with EXEC_PERSISTENT_FLAG EXEC_SHARED_MEMORY_FLAG. The
+ * reply is the worker's pid_t, or -1 if it could not be forked. The
+ * zygote exits when the control socket is closed. */
+#define EXEC_ZYGOTE_FLAG    "--zygote"
+#define EXEC_ZYGOTE_FDS     4
+
+/* A function may also be built as a shared object (-fPIC -shared,
+ * without libcpplambda or libformats, whose symbols the server
+ * exports) and named *.so; the server then loads it and calls
+ * lambda_exec directly, from several threads at once. Only for
+ * trusted code, as it runs inside the server: the operator lists such
+ * functions in SimpleDBConfig::inprocess_functions. */
 extern void lambda_exec(const simpledb::proto::ExecArgs& params,
                 simpledb::proto::ExecResponse& resp);
 
@@ -1,116 +1,916 @@
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include <condition_variable>
+#include <unordered_map>
+#include <cerrno>
+#include <cstring>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <csignal>
+#include <sys/socket.h>
+#include <glog/logging.h>
+
 #include "execution/runtime.h"
+#include "execution/cpplambda.h"
+#include "execution/shared_region.h"
+#include "net/service.h"
 #include "util/exception.h"
 #include "util/path.h"
 #include "config.h"
 
 using namespace std;
 
-void exec_completion_cb(uv_process_t* process, int64_t exit_status, int term_signal)
+size_t env_or(const char* name, const size_t default_value)
+{
+    const char* value = getenv(name);
+    if (value == nullptr || *value == '\0')
+        return default_value;
+
+    return strtoull(value, nullptr, 10);
+}
+
+struct RuntimeSettings
 {
-    auto state = (ExecutionState*) process->data;
+    size_t pool_size;
+    uint64_t idle_timeout_ms;
+    bool shared_memory;
+    uint64_t hello_timeout_ms;
+    bool zygote;
+};
 
-    if (exit_status < 0 || term_signal > 0)
-        throw unix_error("Failed to launch process!", exit_status);
+static const RuntimeSettings& settings()
+{
+    static const RuntimeSettings settings {
+        env_or("SIMPLEDB_LAMBDA_POOL_SIZE", 4),
+        env_or("SIMPLEDB_LAMBDA_IDLE_TIMEOUT_MS", 30000),
+        env_or("SIMPLEDB_LAMBDA_SHARED_MEMORY", 1) != 0,
+        env_or("SIMPLEDB_LAMBDA_HELLO_TIMEOUT_MS", 5000),
+        env_or("SIMPLEDB_LAMBDA_ZYGOTE", 0) != 0,
+    };
+    return settings;
+}
 
-    uv_close((uv_handle_t*) &state->input_pipe, [](uv_handle_t*){});
-    uv_close((uv_handle_t*) &state->output_pipe, [](uv_handle_t*){});
+/* How the processes of a function binary are talked to */
+enum class WorkerMode
+{
+    UNKNOWN,    /* shared memory asked for, its hello not seen yet */
+    SHARED,     /* EXEC_SHARED_MEMORY_FLAG */
+    PIPE,       /* whole messages over stdin/stdout */
+    LEGACY,     /* built before persistent mode: one execution per
+                   process, over stdin/stdout */
+};
+
+/* By function, once known */
+static unordered_map<string, WorkerMode> function_modes;
+
+static WorkerMode mode_of(const string& function)
+{
+    if (!settings().shared_memory)
+        return WorkerMode::PIPE;
+
+    auto it = function_modes.find(function);
+    return it == function_modes.end() ? WorkerMode::UNKNOWN : it->second;
+}
+
+/* A process of one function binary, started in persistent mode. It
+ * serves one execution at a time. In shared memory mode arguments and
+ * response are passed in its two shared regions, their lengths over
+ * its stdin/stdout; otherwise the whole messages go over the pipes. */
+struct LambdaWorker
+{
+    const string function;
+    WorkerMode mode;
+    bool greeted;           /* hello read, or none to come */
+
+    uv_process_t process;
+    uv_pipe_t input_pipe;
+    uv_pipe_t output_pipe;
+    uv_timer_t idle_timer;
+    unsigned open_handles {0};
+    bool forked {false};    /* by a zygote, so no process handle */
+    bool pending {false};   /* forked, the zygote's reply not read yet */
+    bool hung_up {false};   /* EOF seen while pending */
+    bool exited {false};
+    bool reaped {false};    /* one-shot, exited before its output was read */
+    int64_t exit_status {0};
+    int term_signal {0};
+
+    SharedRegion args_region;
+    SharedRegion response_region;
+
+    string output_buffer_ {};
+    string received_ {};    /* output not yet consumed */
+    ExecutionState* current {nullptr};
+
+    LambdaWorker(const string& function, const WorkerMode mode)
+        : function(function), mode(mode),
+        greeted(mode != WorkerMode::UNKNOWN && mode != WorkerMode::SHARED),
+        args_region(SharedRegion::create("simpledb-args")),
+        response_region(SharedRegion::create("simpledb-response"))
+    {}
+};
+
+/* Warm workers by function, most recently used last */
+static unordered_map<string, vector<LambdaWorker*>> idle_workers;
+
+static void on_worker_handle_close(uv_handle_t* handle)
+{
+    auto worker = (LambdaWorker*) handle->data;
+    if (--worker->open_handles == 0)
+        delete worker;
+}
+
+static void close_handle(uv_handle_t* handle)
+{
+    if (!uv_is_closing(handle))
+        uv_close(handle, on_worker_handle_close);
+}
+
+static void forget_idle(LambdaWorker* worker)
+{
+    auto it = idle_workers.find(worker->function);
+    if (it == idle_workers.end())
+        return;
+
+    auto& idle = it->second;
+    idle.erase(remove(idle.begin(), idle.end(), worker), idle.end());
+    uv_timer_stop(&worker->idle_timer);
+}
+
+/* Closing stdin asks the worker to exit; the rest is closed once it has */
+static void retire(LambdaWorker* worker)
+{
+    forget_idle(worker);
+    close_handle((uv_handle_t*) &worker->input_pipe);
+}
+
+static void on_idle_timeout(uv_timer_t* timer)
+{
+    retire((LambdaWorker*) timer->data);
+}
+
+static void release(LambdaWorker* worker)
+{
+    auto& idle = idle_workers[worker->function];
+    if (worker->exited || worker->mode == WorkerMode::LEGACY
+            || idle.size() >= settings().pool_size)
+    {
+        retire(worker);
+        return;
+    }
+
+    idle.push_back(worker);
+
+    int ret;
+    if ((ret = uv_timer_start(&worker->idle_timer, on_idle_timeout,
+                        settings().idle_timeout_ms, 0)) < 0)
+        throw uv_error("Failed to start idle timer.", ret);
+}
+
+static void on_worker_exit(LambdaWorker* worker, int64_t exit_status, int term_signal)
+{
+    if (worker->exited)
+        return;
+
+    worker->exited = true;
+    forget_idle(worker);
+
+    if (!worker->forked)
+        close_handle((uv_handle_t*) &worker->process);
+    close_handle((uv_handle_t*) &worker->input_pipe);
+    close_handle((uv_handle_t*) &worker->output_pipe);
+    close_handle((uv_handle_t*) &worker->idle_timer);
+
+    /* Idle workers may come and go; one that dies mid-execution fails it */
+    if (worker->current != nullptr)
+    {
+        if (exit_status < 0 || term_signal > 0)
+            throw unix_error("Failed to launch process!", exit_status);
 
-    if (state->parser.empty())
         throw runtime_error("No output from execution!");
+    }
+}
 
-    auto output = state->parser.front();
-    state->exec_compl_cb_(state, output);
-    state->parser.pop();
+static void exec_completion_cb(uv_process_t* process, int64_t exit_status, int term_signal)
+{
+    auto worker = (LambdaWorker*) process->data;
+
+    /* A one-shot process exits right after writing its output */
+    if (worker->mode == WorkerMode::LEGACY && worker->current != nullptr)
+    {
+        worker->reaped = true;
+        worker->exit_status = exit_status;
+        worker->term_signal = term_signal;
+        return;
+    }
 
-    // delete state;
+    on_worker_exit(worker, exit_status, term_signal);
 }
 
 void pipe_read_cb(uv_stream_t* handle, ssize_t nread,
             const uv_buf_t* buf)
 {
-    auto exec_state = (ExecutionState*) handle->data;
+    auto worker = (LambdaWorker*) handle->data;
 
+    /* Forked workers are not our children; their exit shows as EOF.
+     * Until the zygote replies, EOF may also mean it failed to fork. */
     if (nread == UV_EOF)
+    {
+        if (worker->pending)
+            worker->hung_up = true;
+        else if (worker->forked || worker->reaped)
+            on_worker_exit(worker, worker->exit_status, worker->term_signal);
         return;
+    }
 
     if (nread < 0)
         throw uv_error("Failed to read output from execution!", nread);
 
-    exec_state->parser.parse(exec_state->output_buffer_.substr(0, nread));
-    exec_state->output_buffer_.clear();
+    worker->received_.append(worker->output_buffer_, 0, nread);
+    worker->output_buffer_.clear();
+
+    while (worker->received_.length() >= sizeof(size_t))
+    {
+        size_t len;
+        memcpy(&len, worker->received_.data(), sizeof(size_t));
+
+        if (!worker->greeted)
+        {
+            if (len != EXEC_SHARED_MEMORY_HELLO)
+                throw runtime_error("Unexpected output from execution!");
+
+            worker->received_.erase(0, sizeof(size_t));
+            worker->greeted = true;
+
+            /* Probed: its execution was held back until now */
+            if (worker->mode == WorkerMode::UNKNOWN)
+            {
+                function_modes[worker->function] = WorkerMode::SHARED;
+                worker->mode = WorkerMode::SHARED;
+                uv_timer_stop(&worker->idle_timer);
+                if (worker->current != nullptr)
+                    worker->current->SendInput(worker);
+            }
+            continue;
+        }
+
+        simpledb::proto::ExecResponse output;
+        if (worker->mode == WorkerMode::SHARED)
+        {
+            worker->received_.erase(0, sizeof(size_t));
+            if (!output.ParseFromArray(worker->response_region.view(len), len))
+                throw runtime_error("Malformed output from execution!");
+        }
+        else
+        {
+            if (worker->received_.length() < sizeof(size_t) + len)
+                break;
+            if (!output.ParseFromArray(worker->received_.data() + sizeof(size_t), len))
+                throw runtime_error("Malformed output from execution!");
+            worker->received_.erase(0, sizeof(size_t) + len);
+        }
+
+        auto state = worker->current;
+        if (state == nullptr)
+            throw runtime_error("Unexpected output from execution!");
+
+        /* Back to the pool first, so the callback may already reuse it */
+        worker->current = nullptr;
+        release(worker);
+
+        state->exec_compl_cb_(state, output);
+    }
 }
 
-void pipe_allocate_read_buffer_cb(uv_handle_t* handle,
-                            size_t suggested_size,
-                            uv_buf_t* buf)
+static void pipe_allocate_read_buffer_cb(uv_handle_t* handle,
+                                    size_t suggested_size,
+                                    uv_buf_t* buf)
 {
-    auto exec_state = (ExecutionState*) handle->data;
-    exec_state->output_buffer_ = string(suggested_size, 0);
-    buf->base = &(exec_state->output_buffer_[0]);
+    auto worker = (LambdaWorker*) handle->data;
+    worker->output_buffer_ = string(suggested_size, 0);
+    buf->base = &(worker->output_buffer_[0]);
     buf->len = suggested_size;
 }
 
-void pipe_write_cb(uv_write_t* req, int status)
+static void pipe_write_cb(uv_write_t* req, int status)
 {
-    auto exec_state = (ExecutionState*) req->data;
     delete req;
 
     if (status < 0)
         throw uv_error("Failed to send input to execution!", status);
+}
 
-    int ret;
-    if ((ret = uv_read_start((uv_stream_t*) &exec_state->output_pipe,
-                        pipe_allocate_read_buffer_cb, pipe_read_cb)) < 0)
-        throw uv_error("Failed to read output from execution!", ret);
+/* Zygote mode: workers are forked by an initialized process of their
+ * function binary (see EXEC_ZYGOTE_FLAG) instead of spawned, skipping
+ * exec, dynamic linking and library start-up. A worker is used as soon
+ * as it is asked for, its input waiting in its socket; the zygote's
+ * replies are read as they come. A binary whose zygote cannot be asked
+ * or fails to fork is spawned directly from then on. */
+struct Zygote
+{
+    const string function;
+    uv_process_t process;
+    uv_poll_t control_poll;
+    int control {-1};
+    unsigned open_handles {0};
+
+    deque<LambdaWorker*> pending;   /* awaiting a pid, in request order */
+    string replies {};
+
+    Zygote(const string& function) : function(function) {}
 };
 
-void ExecutionState::Spawn(const ExecComplCallback& exec_cb)
+/* By function; nullptr for binaries whose zygote failed */
+static unordered_map<string, Zygote*> zygotes;
+
+static void on_zygote_close(uv_handle_t* handle)
 {
-    exec_compl_cb_ = exec_cb;
+    auto zygote = (Zygote*) handle->data;
+    if (--zygote->open_handles > 0)
+        return;
+
+    close(zygote->control);
+    delete zygote;
+}
+
+/* Starts `state` over, on another worker */
+void restart_execution(ExecutionState* state)
+{
+    const ExecComplCallback callback = state->exec_compl_cb_;
+    state->Spawn(callback);
+}
+
+/* The zygote did not fork `worker`: nothing runs behind its sockets */
+static void zygote_fork_failed(LambdaWorker* worker)
+{
+    ExecutionState* state = worker->current;
+    worker->current = nullptr;
+    on_worker_exit(worker, 0, 0);
+
+    if (state != nullptr)
+        restart_execution(state);
+}
+
+static void drop_zygote(Zygote* zygote)
+{
+    zygotes[zygote->function] = nullptr;
+    uv_process_kill(&zygote->process, SIGKILL);
+}
+
+static void on_zygote_reply(Zygote* zygote, const pid_t pid)
+{
+    LambdaWorker* worker = zygote->pending.front();
+    zygote->pending.pop_front();
+    worker->pending = false;
+
+    if (pid <= 0)
+    {
+        LOG(ERROR) << "Zygote of " << zygote->function << " failed to fork";
+        drop_zygote(zygote);
+        zygote_fork_failed(worker);
+    }
+    else if (worker->hung_up)
+    {
+        on_worker_exit(worker, 0, 0);
+    }
+}
+
+static void zygote_poll_cb(uv_poll_t* handle, int status, int events)
+{
+    auto zygote = (Zygote*) handle->data;
+
+    while (status == 0)
+    {
+        char buf[64 * sizeof(pid_t)];
+        const ssize_t n = recv(zygote->control, buf, sizeof(buf), 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        if (n <= 0)
+            break;
+
+        zygote->replies.append(buf, n);
+        while (zygote->replies.length() >= sizeof(pid_t)
+                && !zygote->pending.empty())
+        {
+            pid_t pid;
+            memcpy(&pid, zygote->replies.data(), sizeof(pid_t));
+            zygote->replies.erase(0, sizeof(pid_t));
+            on_zygote_reply(zygote, pid);
+        }
+    }
+
+    /* Hung up or broken; the exit callback cleans up */
+    uv_poll_stop(handle);
+}
+
+static void zygote_exit_cb(uv_process_t* process, int64_t exit_status, int term_signal)
+{
+    auto zygote = (Zygote*) process->data;
+
+    /* Started again when next needed, unless it failed */
+    auto it = zygotes.find(zygote->function);
+    if (it != zygotes.end() && it->second == zygote)
+        zygotes.erase(it);
+
+    /* Unanswered: those already hung up were most likely never forked,
+     * and the binary is spawned directly from then on */
+    deque<LambdaWorker*> pending;
+    pending.swap(zygote->pending);
+    for (LambdaWorker* worker : pending)
+    {
+        worker->pending = false;
+        if (worker->hung_up)
+        {
+            zygotes[zygote->function] = nullptr;
+            zygote_fork_failed(worker);
+        }
+    }
+
+    uv_close((uv_handle_t*) &zygote->control_poll, on_zygote_close);
+    uv_close((uv_handle_t*) process, on_zygote_close);
+}
+
+static Zygote* start_zygote(const string& function)
+{
+    int sv[2];
+    CheckSystemCall("socketpair", socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv));
+
+    /* Only polled: the loop thread never waits on the zygote */
+    const int flags = fcntl(sv[0], F_GETFL);
+    if (flags < 0 || fcntl(sv[0], F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+        close(sv[0]);
+        close(sv[1]);
+        throw unix_error("fcntl");
+    }
+
+    Zygote* zygote = new Zygote(function);
+    zygote->process.data = zygote;
+    zygote->control_poll.data = zygote;
+    zygote->control = sv[0];
 
     int ret;
-    char* argv[2];
-    argv[0] = &function[0];
-    argv[1] = NULL;
+    if ((ret = uv_poll_init(uv_default_loop(), &zygote->control_poll, sv[0])) < 0)
+    {
+        close(sv[1]);
+        close(sv[0]);
+        delete zygote;
+        throw uv_error("Failed to initialize zygote poll.", ret);
+    }
+    zygote->open_handles = 1;
 
-    ret = uv_pipe_init(client->execution_loop, &input_pipe, 1);
-    if (ret < 0)
-        throw uv_error("Failed to initialize IPC pipe.", ret);
-    ret = uv_pipe_init(client->execution_loop, &output_pipe, 1);
-    if (ret < 0)
-        throw uv_error("Failed to initialize IPC pipe.", ret);
+    char* argv[3];
+    string flag { EXEC_ZYGOTE_FLAG };
+    argv[0] = const_cast<char*>(zygote->function.c_str());
+    argv[1] = &flag[0];
+    argv[2] = NULL;
 
     uv_stdio_container_t child_stdio[3];
+    child_stdio[0].flags = UV_INHERIT_FD;
+    child_stdio[0].data.fd = sv[1];
+    child_stdio[1].flags = UV_IGNORE;
+    child_stdio[2].flags = UV_INHERIT_FD;
+    child_stdio[2].data.fd = 2;
+
+    uv_process_options_t options = {0};
+    options.exit_cb = zygote_exit_cb;
+    options.file = zygote->function.c_str();
+    options.args = argv;
+    options.stdio_count = 3;
+    options.stdio = child_stdio;
+
+    ret = uv_spawn(uv_default_loop(), &zygote->process, &options);
+    close(sv[1]);
+    if (ret < 0)
+    {
+        uv_close((uv_handle_t*) &zygote->control_poll, on_zygote_close);
+        throw uv_error("Failed to spawn zygote.", ret);
+    }
+    zygote->open_handles = 2;
+
+    /* Cleaned up by the exit callback */
+    if ((ret = uv_poll_start(&zygote->control_poll, UV_READABLE, zygote_poll_cb)) < 0)
+    {
+        drop_zygote(zygote);
+        throw uv_error("Failed to poll zygote.", ret);
+    }
+
+    return zygote;
+}
+
+static Zygote* acquire_zygote(const string& function)
+{
+    /* Zygotes are only asked of binaries known to speak shared memory */
+    if (!settings().zygote || mode_of(function) != WorkerMode::SHARED)
+        return nullptr;
+
+    auto it = zygotes.find(function);
+    if (it != zygotes.end())
+        return it->second;
+
+    Zygote* zygote = start_zygote(function);
+    zygotes[function] = zygote;
+    return zygote;
+}
+
+/* Asks the zygote for a worker on new stdin/stdout sockets and the
+ * worker's regions, without waiting for its reply; false if it could
+ * not be asked */
+static bool fork_worker(Zygote* zygote, LambdaWorker* worker)
+{
+    int input[2], output[2];
+    CheckSystemCall("socketpair", socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, input));
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, output) < 0)
+    {
+        close(input[0]);
+        close(input[1]);
+        throw unix_error("socketpair");
+    }
+
+    const int fds[EXEC_ZYGOTE_FDS] = { input[0], output[1],
+            worker->args_region.fd(), worker->response_region.fd() };
+
+    char request = 0;
+    struct iovec iov { &request, 1 };
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } cmsg_buf;
+
+    struct msghdr msg {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsg_buf.buf;
+    msg.msg_controllen = sizeof(cmsg_buf.buf);
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    const bool forked = sendmsg(zygote->control, &msg, MSG_NOSIGNAL) == 1;
+
+    /* The worker's ends are its own now */
+    close(input[0]);
+    close(output[1]);
+    if (!forked)
+    {
+        close(input[1]);
+        close(output[0]);
+        return false;
+    }
+
+    int ret;
+    if ((ret = uv_pipe_open(&worker->input_pipe, input[1])) < 0)
+        throw uv_error("Failed to open IPC pipe.", ret);
+    if ((ret = uv_pipe_open(&worker->output_pipe, output[0])) < 0)
+        throw uv_error("Failed to open IPC pipe.", ret);
+
+    worker->pending = true;
+    zygote->pending.push_back(worker);
+    return true;
+}
+
+/* A binary that sent no hello in time was not built for shared
+ * memory: it is marked legacy and its execution started over */
+static void on_hello_timeout(uv_timer_t* timer)
+{
+    auto worker = (LambdaWorker*) timer->data;
+    LOG(WARNING) << worker->function << " did not answer "
+        << EXEC_SHARED_MEMORY_FLAG << "; running it one-shot";
+    function_modes[worker->function] = WorkerMode::LEGACY;
+
+    ExecutionState* state = worker->current;
+    worker->current = nullptr;
+    uv_process_kill(&worker->process, SIGKILL);
+
+    if (state != nullptr)
+        restart_execution(state);
+}
+
+static void spawn_worker(LambdaWorker* worker)
+{
+    const bool shared = worker->mode == WorkerMode::UNKNOWN
+        || worker->mode == WorkerMode::SHARED;
+
+    char* argv[4];
+    string persistent { EXEC_PERSISTENT_FLAG };
+    string shared_memory { EXEC_SHARED_MEMORY_FLAG };
+    argv[0] = const_cast<char*>(worker->function.c_str());
+    argv[1] = &persistent[0];
+    argv[2] = shared ? &shared_memory[0] : NULL;
+    argv[3] = NULL;
+
+    uv_stdio_container_t child_stdio[5];
     child_stdio[0].flags = (uv_stdio_flags) (UV_CREATE_PIPE | UV_READABLE_PIPE);
-    child_stdio[0].data.stream = (uv_stream_t*) &input_pipe;
+    child_stdio[0].data.stream = (uv_stream_t*) &worker->input_pipe;
     child_stdio[1].flags = (uv_stdio_flags) (UV_CREATE_PIPE | UV_WRITABLE_PIPE);
-    child_stdio[1].data.stream = (uv_stream_t*) &output_pipe;
+    child_stdio[1].data.stream = (uv_stream_t*) &worker->output_pipe;
     child_stdio[2].flags = UV_INHERIT_FD;
     child_stdio[2].data.fd = 2;
+    child_stdio[EXEC_ARGS_FD].flags = UV_INHERIT_FD;
+    child_stdio[EXEC_ARGS_FD].data.fd = worker->args_region.fd();
+    child_stdio[EXEC_RESPONSE_FD].flags = UV_INHERIT_FD;
+    child_stdio[EXEC_RESPONSE_FD].data.fd = worker->response_region.fd();
 
     uv_process_options_t options = {0};
     options.exit_cb = exec_completion_cb;
-    options.file = function.c_str();
+    options.file = worker->function.c_str();
     options.args = argv;
-    options.stdio_count = 3;
+    options.stdio_count = shared ? 5 : 3;
     options.stdio = child_stdio;
 
-    if ((ret = uv_spawn(uv_default_loop(), &process, &options)) < 0)
+    int ret;
+    if ((ret = uv_spawn(uv_default_loop(), &worker->process, &options)) < 0)
         throw uv_error("Failed to spawn process.", ret);
 
-    input_pipe.data = this;
-    output_pipe.data = this;
+    if (worker->mode == WorkerMode::UNKNOWN
+            && (ret = uv_timer_start(&worker->idle_timer, on_hello_timeout,
+                        settings().hello_timeout_ms, 0)) < 0)
+        throw uv_error("Failed to start hello timer.", ret);
+}
+
+static LambdaWorker* start_worker(const string& function)
+{
+    uv_loop_t* loop = uv_default_loop();
+    LambdaWorker* worker = new LambdaWorker(function, mode_of(function));
+
+    int ret;
+    ret = uv_pipe_init(loop, &worker->input_pipe, 1);
+    if (ret < 0)
+        throw uv_error("Failed to initialize IPC pipe.", ret);
+    ret = uv_pipe_init(loop, &worker->output_pipe, 1);
+    if (ret < 0)
+        throw uv_error("Failed to initialize IPC pipe.", ret);
+    ret = uv_timer_init(loop, &worker->idle_timer);
+    if (ret < 0)
+        throw uv_error("Failed to initialize idle timer.", ret);
+
+    worker->process.data = worker;
+    worker->input_pipe.data = worker;
+    worker->output_pipe.data = worker;
+    worker->idle_timer.data = worker;
+
+    Zygote* zygote = acquire_zygote(function);
+    if (zygote != nullptr && fork_worker(zygote, worker))
+    {
+        worker->forked = true;
+        worker->open_handles = 3;
+    }
+    else
+    {
+        if (zygote != nullptr)
+            drop_zygote(zygote);
+
+        spawn_worker(worker);
+        worker->open_handles = 4;
+    }
+
+    if ((ret = uv_read_start((uv_stream_t*) &worker->output_pipe,
+                        pipe_allocate_read_buffer_cb, pipe_read_cb)) < 0)
+        throw uv_error("Failed to read output from execution!", ret);
+
+    return worker;
+}
+
+static LambdaWorker* acquire_worker(const string& function)
+{
+    auto it = idle_workers.find(function);
+    if (it == idle_workers.end() || it->second.empty())
+        return start_worker(function);
+
+    LambdaWorker* worker = it->second.back();
+    it->second.pop_back();
+    uv_timer_stop(&worker->idle_timer);
+    return worker;
+}
+
+/* In-process mode: a function built as a shared object is loaded once
+ * and called directly on one of a set of threads of its own, with no
+ * process and no serialization in between. Completions are handed back
+ * to the loop thread. Such functions share the server's address space
+ * and must be trusted and thread safe. */
+typedef void (*LambdaEntry)(const simpledb::proto::ExecArgs& params,
+                            simpledb::proto::ExecResponse& resp);
+
+/* lambda_exec, as mangled by the Itanium C++ ABI */
+static const char* LAMBDA_EXEC_SYMBOL =
+        "_Z11lambda_execRKN8simpledb5proto8ExecArgsERNS0_12ExecResponseE";
+
+struct InProcessJob
+{
+    ExecutionState* state;
+    LambdaEntry entry;
+    const simpledb::proto::ExecArgs* args;
+    simpledb::proto::ExecResponse response {};
+};
+
+/* By path: the identity of the image loaded from it, and its entry */
+static unordered_map<string, pair<string, LambdaEntry>> loaded_functions;
+
+static mutex jobs_lock;
+static condition_variable jobs_wakeup;
+static deque<InProcessJob*> pending_jobs;
+static deque<InProcessJob*> finished_jobs;
+static uv_async_t jobs_finished;
+static bool inprocess_started {false};
+
+static bool is_shared_object(const string& function)
+{
+    static const string suffix { ".so" };
+    return function.length() > suffix.length()
+        && function.compare(function.length() - suffix.length(),
+                            suffix.length(), suffix) == 0;
+}
+
+static LambdaEntry load_function(const string& function, const string& image)
+{
+    auto it = loaded_functions.find(function);
+    if (it != loaded_functions.end() && it->second.first == image)
+        return it->second.second;
+
+    /* dlopen returns whatever is loaded under the same name, so each
+     * image is loaded from a copy of its own, kept open as long as the
+     * server runs. Never closed either: a replaced image may still be
+     * running, and a loaded function stays warm for the next call. */
+    const int fd = SharedRegion::create("simpledb-function");
+    try
+    {
+        const string content = roost::read_file(function);
+        size_t done = 0;
+        while (done < content.length())
+        {
+            const ssize_t n = write(fd, content.data() + done, content.length() - done);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                throw unix_error("Failed to copy function");
+            done += n;
+        }
+    }
+    catch (...)
+    {
+        close(fd);
+        throw;
+    }
+
+    const string path = "/proc/self/fd/" + to_string(fd);
+    void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (handle == nullptr)
+    {
+        close(fd);
+        throw runtime_error(string("Failed to load function: ") + dlerror());
+    }
+
+    auto entry = (LambdaEntry) dlsym(handle, LAMBDA_EXEC_SYMBOL);
+    if (entry == nullptr)
+        throw runtime_error("No lambda_exec in " + function);
+
+    loaded_functions[function] = {image, entry};
+    return entry;
+}
+
+static void complete_job(InProcessJob* job)
+{
+    {
+        const lock_guard<mutex> lguard(jobs_lock);
+        finished_jobs.push_back(job);
+    }
+    uv_async_send(&jobs_finished);
+}
+
+static void run_inprocess_jobs()
+{
+    while (true)
+    {
+        InProcessJob* job;
+        {
+            unique_lock<mutex> ulock(jobs_lock);
+            jobs_wakeup.wait(ulock, []() { return !pending_jobs.empty(); });
+            job = pending_jobs.front();
+            pending_jobs.pop_front();
+        }
+
+        try
+        {
+            job->entry(*job->args, job->response);
+        }
+        catch (exception& e)
+        {
+            job->response.Clear();
+            job->response.set_return_code(EXEC_EXCEPTION);
+            job->response.set_return_output(e.what());
+        }
 
-    s_input_ = string(sizeof(size_t), 0);
-    size_t input_len = args.ByteSize();
-    *((size_t*)(&s_input_[0])) = input_len;
-    s_input_.append(move(args.SerializeAsString()));
+        complete_job(job);
+    }
+}
+
+void inprocess_completion_cb(uv_async_t*)
+{
+    deque<InProcessJob*> jobs;
+    {
+        const lock_guard<mutex> lguard(jobs_lock);
+        jobs.swap(finished_jobs);
+    }
+
+    for (InProcessJob* job : jobs)
+    {
+        auto state = job->state;
+        auto response = move(job->response);
+        delete job;
+
+        state->exec_compl_cb_(state, response);
+    }
+}
+
+static void start_inprocess()
+{
+    int ret;
+    if ((ret = uv_async_init(uv_default_loop(), &jobs_finished,
+                            inprocess_completion_cb)) < 0)
+        throw uv_error("Failed to initialize completion handle.", ret);
+
+    const unsigned threads = max(thread::hardware_concurrency(), 1u);
+    for (unsigned idx = 0; idx < threads; idx++)
+        thread(run_inprocess_jobs).detach();
+
+    inprocess_started = true;
+}
+
+void ExecutionState::Spawn(const ExecComplCallback& exec_cb)
+{
+    exec_compl_cb_ = exec_cb;
+
+    if (!image.empty() && is_shared_object(function))
+    {
+        if (!inprocess_started)
+            start_inprocess();
+
+        auto job = new InProcessJob {this, nullptr, &args};
+        try
+        {
+            job->entry = load_function(function, image);
+        }
+        catch (const exception& e)
+        {
+            /* A bad object fails its executions, not the server */
+            LOG(ERROR) << "Load " << function << " Error: " << e.what();
+            job->response.set_return_code(EXEC_STATUS_ERR);
+            job->response.set_return_output(e.what());
+            complete_job(job);
+            return;
+        }
+
+        {
+            const lock_guard<mutex> lguard(jobs_lock);
+            pending_jobs.push_back(job);
+        }
+        jobs_wakeup.notify_one();
+        return;
+    }
+
+    LambdaWorker* worker = acquire_worker(function);
+    worker->current = this;
+
+    /* A binary being probed gets its input once it has said hello */
+    if (worker->mode != WorkerMode::UNKNOWN)
+        SendInput(worker);
+}
+
+void ExecutionState::SendInput(LambdaWorker* worker)
+{
+    const size_t input_len = args.ByteSizeLong();
+    if (worker->mode == WorkerMode::SHARED)
+    {
+        /* Serialized straight into the worker's region; only the length is sent */
+        if (!args.SerializeToArray(worker->args_region.reserve(input_len), input_len))
+            throw runtime_error("Failed to serialize execution input!");
+
+        s_input_ = string(sizeof(size_t), 0);
+    }
+    else
+    {
+        s_input_ = string(sizeof(size_t) + input_len, 0);
+        if (!args.SerializeToArray(&s_input_[sizeof(size_t)], input_len))
+            throw runtime_error("Failed to serialize execution input!");
+    }
+    memcpy(&s_input_[0], &input_len, sizeof(size_t));
 
     auto input = uv_buf_init(&s_input_[0], s_input_.length());
     uv_write_t* write_req = new uv_write_t();
     write_req->data = this;
 
-    if ((ret = uv_write(write_req, (uv_stream_t*) &input_pipe,
+    int ret;
+    if ((ret = uv_write(write_req, (uv_stream_t*) &worker->input_pipe,
                         &input, 1, pipe_write_cb)) < 0)
         throw uv_error("Failed to send input to execution!", ret);
-}
\ No newline at end of file
+}
@@ -2,44 +2,54 @@
 #define SIMPLEDB_EXEC_STATE_
 
 #include <string>
+#include <vector>
 #include <functional>
 
 #include "net/client.h"
-#include "net/protobuf_stream_parser.h"
 #include "formats/execformats.pb.h"
 extern "C" {
     #include "uv.h"
 }
 
 class ExecutionState;
+struct LambdaWorker;
 
 typedef std::function<void(ExecutionState* state,
                         simpledb::proto::ExecResponse
                     )> ExecComplCallback;
 
+size_t env_or(const char* name, size_t default_value);
+
+/* One execution of a function. It runs on a warm process of that
+ * function binary, started in persistent mode and returned to a per
+ * function pool afterwards; idle processes exit after a timeout.
+ * Binaries are asked for shared memory mode and probed for its hello;
+ * ones that send none (not relinked against this libcpplambda) are
+ * run one-shot over the pipes, a process per execution.
+ * Shared objects (named *.so) that the operator trusts, as marked by
+ * `image`, are called in process on a thread pool instead. */
 class ExecutionState
 {
 private:
     std::string function;
     std::string s_input_;
     simpledb::proto::ExecArgs args;
-    simpledb::proto::ExecResponse resp;
     ExecComplCallback exec_compl_cb_;
-    std::string output_buffer_;
-    ProtobufStreamParser<simpledb::proto::ExecResponse> parser;
-
-    uv_process_t process;
-    uv_pipe_t input_pipe;
-    uv_pipe_t output_pipe;
 
-    friend void exec_completion_cb(uv_process_t* process, int64_t exit_status, int term_signal);
-    friend void pipe_allocate_read_buffer_cb(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf);
     friend void pipe_read_cb(uv_stream_t* handle, ssize_t nread, const uv_buf_t* buf);
-    friend void pipe_write_cb(uv_write_t* req, int status);
+    friend void inprocess_completion_cb(uv_async_t* handle);
+    friend void restart_execution(ExecutionState* state);
+
+    void SendInput(LambdaWorker* worker);
 
 public:
     const uint64_t req_id;
     ClientState* const client;
+    std::vector<std::string> pinned;    /* exec cache files, until completion */
+    std::string memo;                   /* request to memoize the result of */
+    std::string image;                  /* identity of the content of a shared
+                                           object trusted to run in process;
+                                           empty: run in a process */
 
     ExecutionState(uint64_t id,
             ClientState* state,
@@ -50,11 +60,19 @@ public:
                 ExecutionState*,
                 const simpledb::proto::ExecResponse&){}),
             req_id(id), client(state)
-        {
-            process.data = this;
-        }
+        {}
     ~ExecutionState() {}
     void Spawn(const ExecComplCallback& exec_cb);
+
+    size_t input_size() const { return args.ByteSizeLong(); }
 };
 
-#endif /*  SIMPLEDB_EXEC_STATE_ */
\ No newline at end of file
+/* Configured from the environment:
+ *   SIMPLEDB_LAMBDA_POOL_SIZE          idle processes kept per function (4)
+ *   SIMPLEDB_LAMBDA_IDLE_TIMEOUT_MS    before an idle process exits (30000)
+ *   SIMPLEDB_LAMBDA_SHARED_MEMORY      0: pass messages over the pipes (1)
+ *   SIMPLEDB_LAMBDA_HELLO_TIMEOUT_MS   wait for a binary's shared memory
+ *                                      hello before running it one-shot (5000)
+ *   SIMPLEDB_LAMBDA_ZYGOTE             1: fork processes from a zygote (0) */
+
+#endif /*  SIMPLEDB_EXEC_STATE_ */
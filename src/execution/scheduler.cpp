@@ -0,0 +1,185 @@
+#include <cstdlib>
+#include <thread>
+#include <algorithm>
+#include <glog/logging.h>
+
+#include "execution/scheduler.h"
+
+using namespace std;
+
+/* Stats are logged after every this many completions */
+static constexpr uint64_t STATS_LOG_INTERVAL = 1000;
+
+static uint64_t to_ms(const ExecutionScheduler::Clock::duration d)
+{
+    return chrono::duration_cast<chrono::milliseconds>(d).count();
+}
+
+ExecutionScheduler::ExecutionScheduler(const ExecComplCallback& on_completion)
+    : on_completion_(on_completion)
+{
+    slots_ = env_or("SIMPLEDB_MAX_EXECUTIONS", 0);
+    if (slots_ == 0)
+        slots_ = max(thread::hardware_concurrency(), 1u);
+    prefetch_depth_ = env_or("SIMPLEDB_EXEC_PREFETCH_DEPTH", 2 * slots_);
+
+    memory_limit_ = env_or("SIMPLEDB_EXEC_MEMORY_LIMIT", 0);
+    memory_base_ = env_or("SIMPLEDB_EXEC_MEMORY_BASE", 64 * 1024 * 1024);
+    stats_.slots = slots_;
+
+    LOG(INFO) << "Execution slots: " << slots_ << ", prefetch depth: "
+            << (prefetch_depth_ ? to_string(prefetch_depth_) : string("unbounded"))
+            << ", memory limit: "
+            << (memory_limit_ ? to_string(memory_limit_) + " bytes" : string("off"));
+}
+
+bool ExecutionScheduler::fits(const size_t memory) const
+{
+    return memory_limit_ == 0 || running_.empty()
+        || memory_in_use_ + memory <= memory_limit_;
+}
+
+void ExecutionScheduler::prefetch(ClientState* client, const Fetch& fetch)
+{
+    auto& queue = fetch_queues_[client];
+    if (queue.empty())
+        fetch_turns_.push_back(client);
+    queue.push_back(fetch);
+
+    dispatch_fetches();
+}
+
+void ExecutionScheduler::prefetch_done()
+{
+    prefetching_--;
+    dispatch_fetches();
+}
+
+void ExecutionScheduler::dispatch_fetches()
+{
+    while ((prefetch_depth_ == 0 || prefetching_ < prefetch_depth_)
+            && !fetch_turns_.empty())
+    {
+        ClientState* client = fetch_turns_.front();
+        fetch_turns_.pop_front();
+
+        auto it = fetch_queues_.find(client);
+        const Fetch fetch = move(it->second.front());
+        it->second.pop_front();
+        if (it->second.empty())
+            fetch_queues_.erase(it);
+        else
+            fetch_turns_.push_back(client);
+
+        prefetching_++;
+        fetch();
+    }
+}
+
+void ExecutionScheduler::submit(ExecutionState* exec)
+{
+    Pending pending {exec, memory_base_ + exec->input_size(), Clock::now()};
+
+    auto& queue = queues_[exec->client];
+    if (queue.empty())
+        turns_.push_back(exec->client);
+    queue.push_back(pending);
+
+    dispatch();
+}
+
+void ExecutionScheduler::dispatch()
+{
+    while (running_.size() < slots_ && !turns_.empty())
+    {
+        /* Next client in turn whose oldest execution fits */
+        bool started = false;
+        for (size_t n = turns_.size(); n > 0 && !started; n--)
+        {
+            ClientState* client = turns_.front();
+            turns_.pop_front();
+
+            auto it = queues_.find(client);
+            auto& queue = it->second;
+            if (!fits(queue.front().memory))
+            {
+                turns_.push_back(client);
+                continue;
+            }
+
+            const Pending pending = queue.front();
+            queue.pop_front();
+            if (queue.empty())
+                queues_.erase(it);
+            else
+                turns_.push_back(client);
+
+            start(pending);
+            started = true;
+        }
+
+        if (!started)
+            break;
+    }
+}
+
+void ExecutionScheduler::start(const Pending& pending)
+{
+    const auto now = Clock::now();
+    const auto wait = now - pending.queued;
+    stats_.started++;
+    stats_.total_wait += wait;
+    stats_.max_wait = max(stats_.max_wait, wait);
+
+    running_[pending.exec] = {pending.memory, now};
+    memory_in_use_ += pending.memory;
+
+    pending.exec->Spawn(on_completion_);
+
+    /* Out of the first two stages: the next fetch may start */
+    prefetch_done();
+}
+
+void ExecutionScheduler::finish(ExecutionState* exec)
+{
+    auto it = running_.find(exec);
+    if (it == running_.end())
+        return;
+
+    const auto run = Clock::now() - it->second.started;
+    stats_.total_run += run;
+    stats_.max_run = max(stats_.max_run, run);
+    stats_.completed++;
+
+    memory_in_use_ -= it->second.memory;
+    running_.erase(it);
+
+    if (stats_.completed % STATS_LOG_INTERVAL == 0)
+    {
+        const Stats s = stats();
+        LOG(INFO) << "Executions: " << s.completed << " completed, "
+                << s.running << "/" << s.slots << " running, " << s.queued << " queued, "
+                << s.prefetching << " prefetching (" << s.fetch_queued << " waiting to); "
+                << "wait avg " << to_ms(s.total_wait) / s.started << " ms (max "
+                << to_ms(s.max_wait) << "), run avg " << to_ms(s.total_run) / s.completed
+                << " ms (max " << to_ms(s.max_run) << ")";
+    }
+
+    dispatch();
+}
+
+ExecutionScheduler::Stats ExecutionScheduler::stats() const
+{
+    Stats stats = stats_;
+    stats.running = running_.size();
+    stats.queued = 0;
+    for (const auto& queue : queues_)
+        stats.queued += queue.second.size();
+
+    stats.prefetching = prefetching_;
+    stats.fetch_queued = 0;
+    for (const auto& queue : fetch_queues_)
+        stats.fetch_queued += queue.second.size();
+
+    return stats;
+}
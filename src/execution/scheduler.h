@@ -0,0 +1,112 @@
+#ifndef SIMPLEDB_EXEC_SCHEDULER_
+#define SIMPLEDB_EXEC_SCHEDULER_
+
+#include <deque>
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+
+#include "execution/runtime.h"
+
+/* Runs executions as a pipeline of three stages: fetch their inputs,
+ * wait for a slot, run. At most the prefetch depth of executions are
+ * in the first two stages at once, so fetching ahead overlaps with
+ * running without holding the inputs of every queued request; the
+ * rest wait to start fetching.
+ *
+ * Executions are admitted into a fixed number of slots. Waiting
+ * executions, and requests waiting to fetch, are queued per client
+ * and clients are served round-robin, so one client submitting many
+ * executions cannot starve the others. With a memory limit set, an
+ * execution is also held back until its estimated footprint (a fixed
+ * base plus its input size) fits next to those that are running; one
+ * that could never fit still runs, alone.
+ *
+ * Configured from the environment:
+ *   SIMPLEDB_MAX_EXECUTIONS        slots (default: number of cores)
+ *   SIMPLEDB_EXEC_PREFETCH_DEPTH   fetching or waiting (default: twice
+ *                                  the slots; 0: unbounded)
+ *   SIMPLEDB_EXEC_MEMORY_LIMIT     bytes for all running executions (0: off)
+ *   SIMPLEDB_EXEC_MEMORY_BASE      bytes assumed per execution (64 MB)
+ *
+ * Runs on the event loop thread; not thread safe. */
+class ExecutionScheduler
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Stats
+    {
+        unsigned slots {0};
+        unsigned running {0};
+        size_t queued {0};
+        unsigned prefetching {0};           /* fetching or waiting */
+        size_t fetch_queued {0};
+        uint64_t started {0};
+        uint64_t completed {0};
+        Clock::duration total_wait {0};     /* queued until spawned */
+        Clock::duration max_wait {0};
+        Clock::duration total_run {0};      /* spawned until completed */
+        Clock::duration max_run {0};
+    };
+
+private:
+    struct Pending
+    {
+        ExecutionState* exec;
+        size_t memory;
+        Clock::time_point queued;
+    };
+
+    struct Running
+    {
+        size_t memory;
+        Clock::time_point started;
+    };
+
+    typedef std::function<void()> Fetch;
+
+    const ExecComplCallback on_completion_;
+    unsigned slots_;
+    unsigned prefetch_depth_;
+    size_t memory_limit_;
+    size_t memory_base_;
+
+    std::unordered_map<ClientState*, std::deque<Pending>> queues_;
+    std::deque<ClientState*> turns_;    /* clients with queued executions */
+    std::unordered_map<ExecutionState*, Running> running_;
+    size_t memory_in_use_ {0};
+    Stats stats_ {};
+
+    std::unordered_map<ClientState*, std::deque<Fetch>> fetch_queues_;
+    std::deque<ClientState*> fetch_turns_;
+    unsigned prefetching_ {0};
+
+    bool fits(const size_t memory) const;
+    void dispatch_fetches();
+    void dispatch();
+    void start(const Pending& pending);
+
+public:
+    ExecutionScheduler(const ExecComplCallback& on_completion);
+
+    ExecutionScheduler(const ExecutionScheduler&) = delete;
+    ExecutionScheduler& operator=(const ExecutionScheduler&) = delete;
+
+    /* Calls `fetch`, which starts fetching the inputs of an execution
+     * for `client`, now or once there is room ahead of the slots */
+    void prefetch(ClientState* client, const Fetch& fetch);
+
+    /* A prefetched request that was answered without an execution */
+    void prefetch_done();
+
+    /* Spawns a prefetched `exec` now or once it is its turn */
+    void submit(ExecutionState* exec);
+
+    /* Frees the slot of a completed execution and fills it */
+    void finish(ExecutionState* exec);
+
+    Stats stats() const;
+};
+
+#endif /* SIMPLEDB_EXEC_SCHEDULER_ */
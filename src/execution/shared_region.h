@@ -0,0 +1,90 @@
+#ifndef SIMPLEDB_SHARED_REGION_
+#define SIMPLEDB_SHARED_REGION_
+
+#include <string>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "util/exception.h"
+
+/* A memfd mapped by both the server and a function process, used to
+ * pass a serialized message without copying it through a pipe. The
+ * writer grows the file as needed; the reader maps again whenever it
+ * is told of a message longer than its current mapping. */
+class SharedRegion
+{
+private:
+    int fd_;
+    char* data_ {nullptr};
+    size_t size_ {0};
+
+    void map(const size_t size)
+    {
+        if (data_ != nullptr)
+            munmap(data_, size_);
+        data_ = nullptr;
+        size_ = 0;
+
+        void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (data == MAP_FAILED)
+            throw unix_error("Failed to map shared region");
+
+        data_ = (char*) data;
+        size_ = size;
+    }
+
+public:
+    /* A new, empty region, not inherited across exec unless passed on */
+    static int create(const std::string& name)
+    {
+        return CheckSystemCall("memfd_create", memfd_create(name.c_str(), MFD_CLOEXEC));
+    }
+
+    SharedRegion(const int fd) : fd_(fd) {}
+
+    SharedRegion(const SharedRegion&) = delete;
+    SharedRegion& operator=(const SharedRegion&) = delete;
+
+    ~SharedRegion()
+    {
+        if (data_ != nullptr)
+            munmap(data_, size_);
+        close(fd_);
+    }
+
+    int fd() const { return fd_; }
+
+    /* Writer: room for `len` bytes, doubling the file when it is short */
+    char* reserve(const size_t len)
+    {
+        if (len <= size_ && data_ != nullptr)
+            return data_;
+
+        const size_t page = sysconf(_SC_PAGESIZE);
+        size_t size = std::max(size_ * 2, len);
+        size = std::max((size + page - 1) / page * page, page);
+
+        CheckSystemCall("ftruncate", ftruncate(fd_, size));
+        map(size);
+        return data_;
+    }
+
+    /* Reader: the first `len` bytes, as last written by the other side */
+    const char* view(const size_t len)
+    {
+        if (len <= size_ && data_ != nullptr)
+            return data_;
+
+        struct stat st;
+        CheckSystemCall("fstat", fstat(fd_, &st));
+        if ((size_t) st.st_size < len || st.st_size == 0)
+            throw std::runtime_error("Shared region is shorter than its message");
+
+        map(st.st_size);
+        return data_;
+    }
+};
+
+#endif /* SIMPLEDB_SHARED_REGION_ */
@@ -105,7 +105,7 @@ void write_cb(uv_write_t* req, int status)
 void ClientState::Write(string && data)
 {
     int ret;
-    write_buffer_.emplace_back(data);
+    write_buffer_.emplace_back(move(data));
 
     uv_write_t* write_req = new uv_write_t();
     uv_buf_t writebuf = uv_buf_init(&(write_buffer_.back()[0]),
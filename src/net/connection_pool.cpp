@@ -0,0 +1,100 @@
+#include <system_error>
+#include <poll.h>
+#include <unistd.h>
+
+#include <glog/logging.h>
+
+#include "net/connection_pool.h"
+#include "util/exception.h"
+
+using namespace std;
+
+void ConnectionPool::Connection::release()
+{
+    if (pool_ == nullptr || !socket_)
+        return;
+
+    pool_->put_back(move(socket_));
+    pool_ = nullptr;
+}
+
+bool ConnectionPool::healthy(const TCPSocket& socket)
+{
+    /* An idle connection must have nothing to read: readable means the
+     * peer either closed it (EOF), reset it, or sent stray bytes. */
+    struct pollfd pfd;
+    pfd.fd = socket.fd_num();
+    pfd.events = POLLIN | POLLRDHUP;
+    pfd.revents = 0;
+
+    int ret = poll(&pfd, 1, 0);
+    if (ret != 0)
+        return false;
+
+    try
+    {
+        socket.verify_no_errors();
+    }
+    catch (const exception& e)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+unique_ptr<TCPSocket> ConnectionPool::open_connection()
+{
+    unsigned retry = 0;
+
+    while (true)
+    {
+        unique_ptr<TCPSocket> socket = make_unique<TCPSocket>();
+        try
+        {
+            socket->connect(address_);
+            return socket;
+        }
+        catch (system_error& e)
+        {
+            LOG(ERROR) << "Failed to connect to " << address_.str() << " " << e.what();
+
+            if (++retry >= connect_max_retry_)
+                throw;
+        }
+
+        sleep(connect_timeout_seconds_);
+    }
+}
+
+ConnectionPool::Connection ConnectionPool::acquire()
+{
+    {
+        const lock_guard<mutex> lguard(lock_);
+
+        while (!idle_.empty())
+        {
+            unique_ptr<TCPSocket> socket = move(idle_.back());
+            idle_.pop_back();
+
+            if (healthy(*socket))
+                return Connection(this, move(socket));
+
+            LOG(INFO) << "Dropping stale connection to " << address_.str();
+        }
+    }
+
+    /* Connect outside the lock so that slow peers do not stall threads
+     * that could be served from the idle list. */
+    return Connection(this, open_connection());
+}
+
+void ConnectionPool::put_back(unique_ptr<TCPSocket>&& socket)
+{
+    const lock_guard<mutex> lguard(lock_);
+
+    if (idle_.size() >= max_idle_)
+        return;
+
+    idle_.emplace_back(move(socket));
+}
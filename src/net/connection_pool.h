@@ -0,0 +1,76 @@
+#ifndef SIMPLEDB_NET_CONNECTION_POOL_H
+#define SIMPLEDB_NET_CONNECTION_POOL_H
+
+#include <memory>
+#include <mutex>
+#include <deque>
+
+#include "net/socket.h"
+#include "net/address.h"
+
+/* Pool of persistent TCP connections to a single replica.
+ * Connections are checked out for the duration of a request/response
+ * exchange and handed back once the stream is idle again. Idle sockets
+ * are health-checked before reuse, so peers that have closed or reset
+ * the connection in the meantime are transparently replaced. */
+class ConnectionPool
+{
+public:
+    class Connection
+    {
+    private:
+        ConnectionPool* pool_;
+        std::unique_ptr<TCPSocket> socket_;
+
+    public:
+        Connection(ConnectionPool* pool, std::unique_ptr<TCPSocket>&& socket)
+            : pool_(pool), socket_(std::move(socket)) {}
+        Connection(Connection&& other) = default;
+        Connection& operator=(Connection&& other) = default;
+
+        /* A connection that is not released explicitly is assumed to be
+         * in an unknown protocol state (e.g. an exception was thrown
+         * mid-exchange) and is closed instead of being reused. */
+        ~Connection() {}
+
+        TCPSocket& socket() { return *socket_; }
+        TCPSocket* operator->() { return socket_.get(); }
+
+        /* Return the connection to the pool. Must only be called when
+         * every request sent on it has been answered. */
+        void release();
+    };
+
+private:
+    const Address address_;
+    const unsigned max_idle_;
+    const unsigned connect_timeout_seconds_;
+    const unsigned connect_max_retry_;
+
+    std::mutex lock_;
+    std::deque<std::unique_ptr<TCPSocket>> idle_;
+
+    std::unique_ptr<TCPSocket> open_connection();
+    static bool healthy(const TCPSocket& socket);
+    void put_back(std::unique_ptr<TCPSocket>&& socket);
+
+public:
+    ConnectionPool(const Address& address,
+            unsigned max_idle,
+            unsigned connect_timeout_seconds,
+            unsigned connect_max_retry)
+        : address_(address), max_idle_(max_idle),
+            connect_timeout_seconds_(connect_timeout_seconds),
+            connect_max_retry_(connect_max_retry) {}
+    ~ConnectionPool() {}
+
+    ConnectionPool(const ConnectionPool&) = delete;
+    ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+    const Address& address() const { return address_; }
+
+    /* Check out an idle healthy connection, or open a new one. */
+    Connection acquire();
+};
+
+#endif /* SIMPLEDB_NET_CONNECTION_POOL_H */
@@ -61,4 +61,6 @@ void ProtobufStreamParser<Message>::parse(const string& buf)
 template class
 ProtobufStreamParser<simpledb::proto::KVRequest>;
 template class
+ProtobufStreamParser<simpledb::proto::KVResponse>;
+template class
 ProtobufStreamParser<simpledb::proto::ExecResponse>;
\ No newline at end of file
@@ -68,6 +68,8 @@ public:
     bool empty() const { return complete_messages_.empty(); }
     const Message & front() const
         { return complete_messages_.front(); }
+    Message & front()
+        { return complete_messages_.front(); }
 
     /* pop one request */
     void pop() { complete_messages_.pop(); }
@@ -0,0 +1,449 @@
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <glog/logging.h>
+
+#include "net/remote_client.h"
+#include "util/exception.h"
+
+using namespace std;
+
+static constexpr size_t READ_CHUNK_SIZE = 128 * 1024;
+static constexpr int MAX_EVENTS = 64;
+
+/* Values held by a received response: multi ops carry theirs in results */
+static size_t payload_bytes(const simpledb::proto::KVResponse& response)
+{
+    size_t bytes = response.val().length();
+    for (const auto& result : response.results())
+        bytes += result.val().length();
+
+    return bytes;
+}
+
+void RemoteClient::Batch::expect(RemoteClient* client, const size_t count)
+{
+    const lock_guard<mutex> lguard(lock_);
+    client_ = client;
+    remaining_ += count;
+}
+
+void RemoteClient::Batch::complete(Completion&& completion)
+{
+    {
+        const lock_guard<mutex> lguard(lock_);
+        buffered_bytes_ += payload_bytes(completion.response);
+        done_.emplace_back(move(completion));
+    }
+
+    ready_.notify_one();
+}
+
+bool RemoteClient::Batch::window_full(const size_t inflight_bytes,
+                                    const size_t window_bytes)
+{
+    const lock_guard<mutex> lguard(lock_);
+
+    if (inflight_bytes + buffered_bytes_ < window_bytes)
+        return false;
+
+    /* Ask to be woken up once the caller has consumed something */
+    stalled_ = true;
+    return true;
+}
+
+size_t RemoteClient::Batch::remaining()
+{
+    const lock_guard<mutex> lguard(lock_);
+    return remaining_;
+}
+
+RemoteClient::Batch::~Batch()
+{
+    while (remaining() > 0)
+        next();
+}
+
+RemoteClient::Completion RemoteClient::Batch::next()
+{
+    unique_lock<mutex> ulock(lock_);
+    ready_.wait(ulock, [this]() { return !done_.empty(); });
+
+    Completion completion = move(done_.front());
+    done_.pop_front();
+    remaining_--;
+    buffered_bytes_ -= payload_bytes(completion.response);
+
+    if (stalled_)
+    {
+        stalled_ = false;
+        client_->wake();
+    }
+
+    return completion;
+}
+
+RemoteClient::RemoteClient(const size_t window, const size_t window_bytes)
+    : window_(max<size_t>(window, 1)), window_bytes_(window_bytes)
+{
+    epoll_fd_ = CheckSystemCall("epoll_create1", epoll_create1(EPOLL_CLOEXEC));
+    wakeup_fd_ = CheckSystemCall("eventfd", eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = 0;
+    CheckSystemCall("epoll_ctl", epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wakeup_fd_, &ev));
+
+    engine_ = thread(&RemoteClient::run, this);
+}
+
+RemoteClient::~RemoteClient()
+{
+    {
+        const lock_guard<mutex> lguard(lock_);
+        stopping_ = true;
+    }
+
+    wake();
+    engine_.join();
+
+    close(wakeup_fd_);
+    close(epoll_fd_);
+}
+
+void RemoteClient::submit(Batch& batch,
+                        const uint64_t tag,
+                        ConnectionPool::Connection&& conn,
+                        const size_t count,
+                        RequestFactory&& make_request)
+{
+    if (count == 0)
+    {
+        conn.release();
+        return;
+    }
+
+    batch.expect(this, count);
+
+    {
+        const lock_guard<mutex> lguard(lock_);
+        if (!failed_)
+        {
+            incoming_.emplace_back(make_unique<Job>(&batch, tag, move(conn),
+                                                    move(make_request), count));
+            wake();
+            return;
+        }
+    }
+
+    conn.release();
+    for (size_t index = 0; index < count; index++)
+        batch.complete(Completion{tag, index, false, {}});
+}
+
+void RemoteClient::wake()
+{
+    uint64_t one = 1;
+    if (write(wakeup_fd_, &one, sizeof(one)) < 0)
+        LOG(ERROR) << "Failed to wake up remote client engine";
+}
+
+bool RemoteClient::start_job(Job* job)
+{
+    job->conn->set_blocking(false);
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = job->id;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, job->conn->fd_num(), &ev) < 0)
+    {
+        LOG(ERROR) << "Failed to register connection: " << strerror(errno);
+        return false;
+    }
+
+    fill(job);
+    return on_writable(job);
+}
+
+void RemoteClient::fill(Job* job)
+{
+    /* Sliding window: top the pipeline back up as responses drain it.
+     * The byte check happens before a request is added, so a value
+     * larger than the whole window still goes out once the pipe is empty. */
+    while (job->next < job->total && job->outstanding < window_)
+    {
+        if (job->batch->window_full(job->inflight_bytes, window_bytes_))
+            break;
+
+        simpledb::proto::KVRequest request;
+        job->make_request(job->next, request);
+        request.set_id(job->next);
+
+        const size_t len = request.ByteSizeLong();
+        job->write_buffer.append((const char*) &len, sizeof(len));
+        job->write_buffer.append(request.SerializeAsString());
+
+        job->request_bytes[job->next] = len;
+        job->inflight_bytes += len;
+        job->outstanding++;
+        job->next++;
+    }
+}
+
+void RemoteClient::refill()
+{
+    vector<Job*> failed;
+
+    for (auto& entry : jobs_)
+    {
+        Job* job = entry.second.get();
+        try
+        {
+            fill(job);
+            if (on_writable(job))
+                continue;
+        }
+        catch (const exception& e)
+        {
+            LOG(ERROR) << "Remote request failed: " << e.what();
+        }
+
+        failed.push_back(job);
+    }
+
+    for (Job* job : failed)
+        finish(job, false);
+}
+
+void RemoteClient::update_events(Job* job)
+{
+    const bool want_write = job->write_offset < job->write_buffer.length();
+    if (want_write == job->want_write)
+        return;
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | (want_write ? EPOLLOUT : 0);
+    ev.data.u64 = job->id;
+    CheckSystemCall("epoll_ctl", epoll_ctl(epoll_fd_, EPOLL_CTL_MOD,
+                                    job->conn->fd_num(), &ev));
+    job->want_write = want_write;
+}
+
+bool RemoteClient::on_writable(Job* job)
+{
+    while (job->write_offset < job->write_buffer.length())
+    {
+        ssize_t n = ::write(job->conn->fd_num(),
+                        job->write_buffer.data() + job->write_offset,
+                        job->write_buffer.length() - job->write_offset);
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (errno == EINTR)
+                continue;
+
+            LOG(ERROR) << "Write failed: " << strerror(errno);
+            return false;
+        }
+
+        job->write_offset += n;
+    }
+
+    if (job->write_offset == job->write_buffer.length())
+    {
+        job->write_buffer.clear();
+        job->write_offset = 0;
+    }
+
+    update_events(job);
+    return true;
+}
+
+bool RemoteClient::on_readable(Job* job)
+{
+    string buffer(READ_CHUNK_SIZE, 0);
+
+    while (true)
+    {
+        ssize_t n = ::read(job->conn->fd_num(), &buffer[0], buffer.length());
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (errno == EINTR)
+                continue;
+
+            LOG(ERROR) << "Read failed: " << strerror(errno);
+            return false;
+        }
+
+        if (n == 0)
+        {
+            LOG(ERROR) << "Connection closed by peer with "
+                        << job->outstanding << " requests outstanding";
+            return false;
+        }
+
+        job->parser.parse(buffer.substr(0, n));
+    }
+
+    while (not job->parser.empty())
+    {
+        auto& response = job->parser.front();
+        const uint64_t index = response.id();
+
+        if (index >= job->total || job->answered[index])
+        {
+            LOG(ERROR) << "Unexpected response id=" << index;
+            return false;
+        }
+
+        job->answered[index] = true;
+        job->outstanding--;
+        job->inflight_bytes -= job->request_bytes[index];
+        job->batch->complete(Completion{job->tag, index, true, move(response)});
+        job->parser.pop();
+    }
+
+    fill(job);
+    return on_writable(job);
+}
+
+void RemoteClient::finish(Job* job, const bool ok)
+{
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, job->conn->fd_num(), nullptr);
+
+    if (ok)
+    {
+        job->conn->set_blocking(true);
+        job->conn.release();
+    }
+    else
+    {
+        /* Fail everything that has not been answered; the connection
+         * is in an unknown state and is dropped with the job. */
+        for (size_t index = 0; index < job->total; index++)
+        {
+            if (!job->answered[index])
+                job->batch->complete(Completion{job->tag, index, false, {}});
+        }
+    }
+
+    jobs_.erase(job->id);
+}
+
+/* The engine cannot go on: every job, running or queued, fails, and so
+ * does any submitted later */
+void RemoteClient::fail_all()
+{
+    {
+        const lock_guard<mutex> lguard(lock_);
+        failed_ = true;
+        for (auto& job : incoming_)
+        {
+            job->id = next_job_id_++;
+            jobs_.emplace(job->id, move(job));
+        }
+        incoming_.clear();
+    }
+
+    while (!jobs_.empty())
+        finish(jobs_.begin()->second.get(), false);
+}
+
+void RemoteClient::run()
+{
+    struct epoll_event events[MAX_EVENTS];
+
+    while (true)
+    {
+        int n = epoll_wait(epoll_fd_, events, MAX_EVENTS, -1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            LOG(ERROR) << "epoll_wait failed: " << strerror(errno);
+            fail_all();
+            return;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            vector<Job*> ready;
+
+            const uint64_t id = events[i].data.u64;
+
+            if (id == 0)
+            {
+                uint64_t count;
+                while (read(wakeup_fd_, &count, sizeof(count)) > 0) {}
+
+                vector<unique_ptr<Job>> incoming;
+                {
+                    const lock_guard<mutex> lguard(lock_);
+                    if (stopping_)
+                        return;
+                    incoming.swap(incoming_);
+                }
+
+                /* Woken up because a caller freed up window space */
+                refill();
+
+                for (auto& job : incoming)
+                {
+                    job->id = next_job_id_++;
+                    ready.push_back(job.get());
+                    jobs_.emplace(job->id, move(job));
+                }
+            }
+            else
+            {
+                /* A job finished earlier in this round must not be touched */
+                auto it = jobs_.find(id);
+                if (it == jobs_.end())
+                    continue;
+
+                ready.push_back(it->second.get());
+            }
+
+            for (Job* job : ready)
+            {
+                bool ok;
+
+                try
+                {
+                    if (id == 0)
+                    {
+                        ok = start_job(job);
+                    }
+                    else
+                    {
+                        ok = true;
+                        if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+                            ok = on_readable(job);
+                        if (ok && (events[i].events & EPOLLOUT))
+                            ok = on_writable(job);
+                    }
+                }
+                catch (const exception& e)
+                {
+                    LOG(ERROR) << "Remote request failed: " << e.what();
+                    ok = false;
+                }
+
+                if (!ok)
+                    finish(job, false);
+                else if (job->next == job->total && job->outstanding == 0)
+                    finish(job, true);
+            }
+        }
+    }
+}
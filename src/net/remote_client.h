@@ -0,0 +1,148 @@
+#ifndef SIMPLEDB_NET_REMOTE_CLIENT_H
+#define SIMPLEDB_NET_REMOTE_CLIENT_H
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+
+#include "net/connection_pool.h"
+#include "net/protobuf_stream_parser.h"
+#include "formats/netformats.pb.h"
+
+/* Event-driven client for remote KV operations.
+ * A single engine thread multiplexes every outstanding exchange over
+ * non-blocking connections checked out of the replica ConnectionPools.
+ * Callers submit one job per replica and then drain the completions on
+ * their own thread, so fan-out to N replicas costs no thread creation. */
+class RemoteClient
+{
+public:
+    struct Completion
+    {
+        uint64_t tag;       /* tag the job was submitted with */
+        uint64_t index;     /* index passed to the request factory */
+        bool ok;            /* false if the connection failed */
+        simpledb::proto::KVResponse response;
+    };
+
+    /* Builds the request with the given index. Runs on the engine
+     * thread, only once the request is about to be sent. */
+    typedef std::function<void(const size_t index,
+                        simpledb::proto::KVRequest& request)> RequestFactory;
+
+    /* Completion queue for one logical operation. Owned by the caller;
+     * the destructor waits for (and discards) whatever is still
+     * outstanding, so submitted jobs never outlive the caller state
+     * their request factories refer to. */
+    class Batch
+    {
+    private:
+        std::mutex lock_;
+        std::condition_variable ready_;
+        std::deque<Completion> done_;
+        size_t remaining_ {0};
+
+        /* Response bytes received but not yet taken by the caller. They
+         * count against the byte window of every job in this batch. */
+        size_t buffered_bytes_ {0};
+        bool stalled_ {false};
+        RemoteClient* client_ {nullptr};
+
+        friend class RemoteClient;
+        void expect(RemoteClient* client, const size_t count);
+        void complete(Completion&& completion);
+        bool window_full(const size_t inflight_bytes, const size_t window_bytes);
+
+    public:
+        Batch() {}
+        ~Batch();
+
+        size_t remaining();
+
+        /* Block until the next completion is available. */
+        Completion next();
+    };
+
+private:
+    struct Job
+    {
+        uint64_t id {0};    /* epoll data of its connection; never reused */
+        Batch* batch;
+        const uint64_t tag;
+        ConnectionPool::Connection conn;
+        RequestFactory make_request;
+        size_t total;
+        size_t next {0};
+        size_t outstanding {0};
+        size_t inflight_bytes {0};
+        std::vector<bool> answered;
+        std::vector<size_t> request_bytes;
+
+        std::string write_buffer {};
+        size_t write_offset {0};
+        bool want_write {false};
+        ProtobufStreamParser<simpledb::proto::KVResponse> parser {};
+
+        Job(Batch* batch, const uint64_t tag,
+            ConnectionPool::Connection&& conn,
+            RequestFactory&& make_request, const size_t total)
+            : batch(batch), tag(tag), conn(std::move(conn)),
+                make_request(std::move(make_request)),
+                total(total), answered(total, false),
+                request_bytes(total, 0) {}
+    };
+
+    const size_t window_;
+    const size_t window_bytes_;
+
+    int epoll_fd_;
+    int wakeup_fd_;
+    std::thread engine_;
+
+    std::mutex lock_;
+    std::vector<std::unique_ptr<Job>> incoming_;
+    bool stopping_ {false};
+    bool failed_ {false};       /* the engine is gone; jobs fail at once */
+
+    /* By id, so an event left over from a finished job finds nothing
+     * even when a new job got its address. Id 0 is the wakeup fd. */
+    std::unordered_map<uint64_t, std::unique_ptr<Job>> jobs_;
+    uint64_t next_job_id_ {1};
+
+    void run();
+    void fail_all();
+    void wake();
+    void refill();
+    bool start_job(Job* job);
+    void fill(Job* job);
+    void update_events(Job* job);
+    bool on_writable(Job* job);
+    bool on_readable(Job* job);
+    void finish(Job* job, const bool ok);
+
+public:
+    /* Each job keeps at most `window` requests and `window_bytes` bytes
+     * (requests on the wire plus responses not yet consumed) in flight. */
+    RemoteClient(const size_t window, const size_t window_bytes);
+    ~RemoteClient();
+
+    RemoteClient(const RemoteClient&) = delete;
+    RemoteClient& operator=(const RemoteClient&) = delete;
+
+    /* Issue `count` requests over `conn`. Completions are delivered to
+     * `batch` in arrival order, labelled with `tag`; the connection goes
+     * back to its pool once every response has been received. */
+    void submit(Batch& batch,
+                const uint64_t tag,
+                ConnectionPool::Connection&& conn,
+                const size_t count,
+                RequestFactory&& make_request);
+};
+
+#endif /* SIMPLEDB_NET_REMOTE_CLIENT_H */
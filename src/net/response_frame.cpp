@@ -0,0 +1,102 @@
+#include <cstring>
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
+
+#include "net/response_frame.h"
+
+using namespace std;
+using namespace simpledb::proto;
+
+using google::protobuf::io::CodedOutputStream;
+using google::protobuf::internal::WireFormatLite;
+
+static inline uint32_t value_tag(const uint32_t field)
+{
+    return WireFormatLite::MakeTag(field, WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+}
+
+static inline size_t field_header_size(const uint32_t field, const size_t length)
+{
+    return CodedOutputStream::VarintSize32(value_tag(field))
+            + CodedOutputStream::VarintSize64(length);
+}
+
+static inline uint8_t* write_field_header(const uint32_t field, const size_t length,
+                                        uint8_t* target)
+{
+    target = CodedOutputStream::WriteVarint32ToArray(value_tag(field), target);
+    return CodedOutputStream::WriteVarint64ToArray(length, target);
+}
+
+ResponseFrame::ResponseFrame(string& buffer, const KVResponse& head)
+    : buffer_(buffer)
+{
+    buffer_.assign(sizeof(size_t), 0);
+    head.AppendToString(&buffer_);
+}
+
+char* ResponseFrame::add_field(const uint32_t field, const size_t length)
+{
+    const size_t offset = buffer_.length();
+    buffer_.resize(offset + field_header_size(field, length) + length);
+
+    return (char*) write_field_header(field, length, (uint8_t*) &buffer_[offset]);
+}
+
+void ResponseFrame::reserve_results(const size_t count, const size_t length)
+{
+    /* At most: the result's tag and length, the value's tag and length
+     * (a length taking up to 10 bytes), and the immutable flag; an error
+     * result takes less */
+    const size_t result_overhead = 2 * (1 + 10) + 2;
+    buffer_.reserve(buffer_.length() + count * result_overhead + length);
+}
+
+char* ResponseFrame::add_val(const size_t length)
+{
+    return add_field(KVResponse::kValFieldNumber, length);
+}
+
+char* ResponseFrame::add_result_val(const size_t length, const bool immutable)
+{
+    /* return_code is STATUS_OK, i.e. zero, and thus left out; so is
+     * immutable when false */
+    const uint32_t immutable_tag = WireFormatLite::MakeTag(KeyResult::kImmutableFieldNumber,
+                                                        WireFormatLite::WIRETYPE_VARINT);
+    const size_t immutable_length = immutable
+                                    ? CodedOutputStream::VarintSize32(immutable_tag) + 1
+                                    : 0;
+    const size_t result_length = immutable_length
+                            + field_header_size(KeyResult::kValFieldNumber, length) + length;
+    uint8_t* result = (uint8_t*) add_field(KVResponse::kResultsFieldNumber, result_length);
+
+    if (immutable)
+    {
+        result = CodedOutputStream::WriteVarint32ToArray(immutable_tag, result);
+        *result++ = 1;
+    }
+
+    return (char*) write_field_header(KeyResult::kValFieldNumber, length, result);
+}
+
+void ResponseFrame::add_result(const KeyResult& result)
+{
+    const size_t length = result.ByteSizeLong();
+    char* target = add_field(KVResponse::kResultsFieldNumber, length);
+    result.SerializeWithCachedSizesToArray((uint8_t*) target);
+}
+
+void ResponseFrame::finish()
+{
+    const size_t length = buffer_.length() - sizeof(size_t);
+    memcpy(&buffer_[0], &length, sizeof(length));
+}
+
+void ResponseFrame::serialize(const KVResponse& response, string& buffer)
+{
+    const size_t length = response.ByteSizeLong();
+    buffer.resize(sizeof(size_t) + length);
+    memcpy(&buffer[0], &length, sizeof(length));
+    response.SerializeWithCachedSizesToArray((uint8_t*) &buffer[sizeof(size_t)]);
+}
@@ -0,0 +1,46 @@
+#ifndef SIMPLEDB_NET_RESPONSE_FRAME_H
+#define SIMPLEDB_NET_RESPONSE_FRAME_H
+
+#include <string>
+
+#include "formats/netformats.pb.h"
+
+/* A response as it goes on the wire (native size_t length followed by
+ * the serialized KVResponse), built in place in the outgoing buffer.
+ * Values are appended as raw fields after the head, which protobuf
+ * accepts as it merges fields in any order, so storage can copy them
+ * straight into the frame instead of into a message first. */
+class ResponseFrame
+{
+private:
+    std::string& buffer_;
+
+    char* add_field(const uint32_t field, const size_t length);
+
+public:
+    ResponseFrame(std::string& buffer, const simpledb::proto::KVResponse& head);
+
+    size_t size() const { return buffer_.length(); }
+    void truncate(const size_t size) { buffer_.resize(size); }
+
+    /* Make room for `count` more KeyResults carrying `length` bytes of
+     * values in all, so that adding them never reallocates */
+    void reserve_results(const size_t count, const size_t length);
+
+    /* Reserve room for KVResponse.val, or for one more OK KeyResult
+     * carrying a value (and whether it is immutable), and return where
+     * the value bytes go. Only valid until the frame grows again. */
+    char* add_val(const size_t length);
+    char* add_result_val(const size_t length, const bool immutable);
+
+    void add_result(const simpledb::proto::KeyResult& result);
+
+    /* Fill in the length prefix */
+    void finish();
+
+    /* Frame a response that is already complete */
+    static void serialize(const simpledb::proto::KVResponse& response,
+                        std::string& buffer);
+};
+
+#endif /* SIMPLEDB_NET_RESPONSE_FRAME_H */
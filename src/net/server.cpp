@@ -1,11 +1,11 @@
 #include <string>
-#include <queue>
 #include <exception>
 #include <glog/logging.h>
 
 #include "net/server.h"
 #include "net/service.h"
 #include "net/client.h"
+#include "execution/scheduler.h"
 #include "storage/db.h"
 #include "formats/netformats.pb.h"
 #include "util/exception.h"
@@ -19,24 +19,29 @@ extern "C" {
 using namespace std;
 using namespace simpledb::proto;
 
-static queue<ExecutionState*> pending_execution;
-static unsigned running_execution;
-
 static void on_execution_completion(
             ExecutionState* exec_state,
             simpledb::proto::ExecResponse response);
 static void on_work_completion(uv_work_t* work, int status);
 
+/* Built on first use, once logging is up */
+static ExecutionScheduler& scheduler()
+{
+    static ExecutionScheduler instance {on_execution_completion};
+    return instance;
+}
+
 static void on_execution_completion(
             ExecutionState* exec_state,
             simpledb::proto::ExecResponse response)
 {
-    running_execution--;
     WorkRequest* work_request = new WorkRequest{exec_state->req_id,
                                                 exec_state->client,
                                                 WorkRequest::EXEC};
 
     work_request->exec = response;
+    work_request->pinned = move(exec_state->pinned);
+    work_request->memo = move(exec_state->memo);
 
     uv_work_t* work = new uv_work_t();
     work->data = work_request;
@@ -49,13 +54,7 @@ static void on_execution_completion(
         throw uv_error("Failed to launch work handler", ret);
     }
 
-    if (!pending_execution.empty())
-    {
-        running_execution++;
-        auto execution = pending_execution.front();
-        pending_execution.pop();
-        execution->Spawn(on_execution_completion);
-    }
+    scheduler().finish(exec_state);
 }
 
 static void on_work_completion(uv_work_t* work, int status)
@@ -71,16 +70,13 @@ static void on_work_completion(uv_work_t* work, int status)
 
     ClientState* client = work_result->client;
     ExecutionState* exec = nullptr;
-    string s_response(sizeof(size_t), 0);
-    size_t response_len;
 
     switch (work_result->tag)
     {
         case WorkResult::KV:
-            response_len = work_result->kv.ByteSize();
-            *((size_t*)(&s_response[0])) = response_len;
-            s_response.append(move(work_result->kv.SerializeAsString()));
-            client->Write(move(s_response));
+            client->Write(move(work_result->frame));
+            if (work_result->memoized)
+                scheduler().prefetch_done();
             break;
 
         case WorkResult::EXEC:
@@ -90,15 +86,10 @@ static void on_work_completion(uv_work_t* work, int status)
                         work_result->exec.function(),
                         move(work_result->exec)
                 );
-            if (running_execution < DEFAULT_MAX_EXECUTIONS)
-            {
-                running_execution++;
-                exec->Spawn(on_execution_completion);
-            }
-            else
-            {
-                pending_execution.push(exec);
-            }
+            exec->pinned = move(work_result->pinned);
+            exec->memo = move(work_result->memo);
+            exec->image = move(work_result->image);
+            scheduler().submit(exec);
             break;
 
         default:
@@ -118,13 +109,22 @@ static void on_new_request(const uv_tcp_t* handle, const KVRequest& request)
     uv_work_t* work = new uv_work_t();
     work->data = work_request;
 
-    int ret;
-    if ((ret = uv_queue_work(uv_default_loop(), work,
-                Worker::process_work, on_work_completion)) < 0)
+    auto queue_work = [work]()
     {
-        LOG(ERROR) << "Failed to launch work handler. Error: " << uv_strerror(ret);
-        throw uv_error("Failed to launch work handler", ret);
-    }
+        int ret;
+        if ((ret = uv_queue_work(uv_default_loop(), work,
+                    Worker::process_work, on_work_completion)) < 0)
+        {
+            LOG(ERROR) << "Failed to launch work handler. Error: " << uv_strerror(ret);
+            throw uv_error("Failed to launch work handler", ret);
+        }
+    };
+
+    /* Executions fetch their inputs only as far ahead as the scheduler allows */
+    if (work_request->kv.ReqOps_case() == KVRequest::ReqOpsCase::kExecRequest)
+        scheduler().prefetch(state, queue_work);
+    else
+        queue_work();
 }
 
 void ServerState::Listen()
@@ -139,7 +139,6 @@ void ServerState::Listen()
             return;
         }
 
-        // LOG(ERROR) << "[CONNECTION]";
         ClientState* client = new ClientState((uv_tcp_t*) server);
         client->Read(on_new_request);
     };
@@ -1,11 +1,15 @@
 #include <string>
 #include <chrono>
+#include <cstdio>
 #include <iostream>
 #include <fstream>
+#include <unordered_map>
+#include <unordered_set>
 #include <glog/logging.h>
 
 #include "storage/db.h"
 #include "net/service.h"
+#include "net/response_frame.h"
 #include "util/path.h"
 #include "util/file_descriptor.h"
 
@@ -21,25 +25,42 @@ using namespace std::chrono;
 using namespace simpledb::proto;
 
 simpledb::storage::SimpleDB* Worker::db {nullptr};
-roost::path Worker::cache_path;
+simpledb::storage::DiskCache* Worker::exec_cache {nullptr};
+unordered_set<string> Worker::inprocess_functions {};
 
+/* Gets write their values straight into `frame`; every other request
+ * fills in `response` and leaves `frame` empty. */
 void Worker::process_kv_request(const KVRequest& request,
-                                    KVResponse& response)
+                                    KVResponse& response,
+                                    string& frame)
 {
-    string content;
     simpledb::storage::DbOpStatus status;
 
     switch(request.ReqOps_case())
     {
         case KVRequest::ReqOpsCase::kGetRequest:
-            // LOG(ERROR) << "GET " << request.get_request().key();
-            status = db->local_get(simpledb::storage::GetRequest(request.get_request().key()), content);
+        {
+            KVResponse head;
+            head.set_id(request.id());
+            ResponseFrame out(frame, head);
+
+            status = db->local_get_into(simpledb::storage::GetRequest(request.get_request().key()),
+                [&out](const simpledb::storage::GetRequest&, const size_t length, const bool)
+                {
+                    return out.add_val(length);
+                }
+            );
+
+            if (status == simpledb::storage::DbOpStatus::STATUS_OK)
+                out.finish();
+            else
+                frame.clear();
+
             response.set_return_code(static_cast<uint32_t>(status));
-            response.set_val(content);
             break;
+        }
 
         case KVRequest::ReqOpsCase::kPutRequest:
-            // LOG(ERROR) << "PUT " << request.put_request().key();
             status = db->local_put(simpledb::storage::PutRequest(request.put_request().key(),
                                                                 request.put_request().val(),
                                                                 request.put_request().immutable(),
@@ -48,11 +69,102 @@ void Worker::process_kv_request(const KVRequest& request,
             break;
 
         case KVRequest::ReqOpsCase::kDeleteRequest:
-            // LOG(ERROR) << "DEL " << request.delete_request().key();
             status = db->local_del(request.delete_request().key());
             response.set_return_code(static_cast<uint32_t>(status));
             break;
 
+        case KVRequest::ReqOpsCase::kMultiGetRequest:
+        {
+            vector<simpledb::storage::GetRequest> get_requests;
+            for (auto &key: request.multi_get_request().keys())
+                get_requests.emplace_back(key);
+
+            KVResponse head;
+            head.set_id(request.id());
+            ResponseFrame out(frame, head);
+            size_t mark = out.size();
+
+            db->local_multi_get_into(get_requests,
+                [&out](const size_t count, const size_t length)
+                {
+                    out.reserve_results(count, length);
+                },
+                [&out](const simpledb::storage::GetRequest&, const size_t length,
+                    const bool immutable)
+                {
+                    return out.add_result_val(length, immutable);
+                },
+                [&out, &mark](const simpledb::storage::GetRequest&,
+                            const simpledb::storage::DbOpStatus status)
+                {
+                    /* Drop whatever room a failed read had reserved */
+                    if (status != simpledb::storage::DbOpStatus::STATUS_OK)
+                    {
+                        out.truncate(mark);
+                        KeyResult result;
+                        result.set_return_code(static_cast<uint32_t>(status));
+                        out.add_result(result);
+                    }
+                    mark = out.size();
+                }
+            );
+
+            out.finish();
+            break;
+        }
+
+        case KVRequest::ReqOpsCase::kMultiPutRequest:
+        {
+            vector<simpledb::storage::PutRequest> put_requests;
+            for (auto &req: request.multi_put_request().requests())
+                put_requests.emplace_back(req.key(), req.val(),
+                                        req.immutable(), req.executable());
+
+            db->local_multi_put(put_requests,
+                [&response](const simpledb::storage::PutRequest&,
+                            const simpledb::storage::DbOpStatus status)
+                {
+                    response.add_results()->set_return_code(static_cast<uint32_t>(status));
+                }
+            );
+            break;
+        }
+
+        case KVRequest::ReqOpsCase::kMultiDeleteRequest:
+        {
+            vector<string> keys(request.multi_delete_request().keys().begin(),
+                                request.multi_delete_request().keys().end());
+
+            db->local_multi_del(keys,
+                [&response](const string&,
+                            const simpledb::storage::DbOpStatus status)
+                {
+                    response.add_results()->set_return_code(static_cast<uint32_t>(status));
+                }
+            );
+            break;
+        }
+
+        case KVRequest::ReqOpsCase::kMultiStatRequest:
+        {
+            for (auto &key: request.multi_stat_request().keys())
+            {
+                ObjectMetadata metadata;
+                status = db->local_stat(key, metadata);
+
+                auto result = response.add_results();
+                result->set_return_code(static_cast<uint32_t>(status));
+                if (status == simpledb::storage::DbOpStatus::STATUS_OK)
+                {
+                    /* Where the content lives is this replica's business */
+                    metadata.clear_blob_id();
+                    result->set_immutable(metadata.immutable());
+                    *result->mutable_metadata() = move(metadata);
+                }
+            }
+            break;
+        }
+
         default:
             throw runtime_error("Invalid KVRequest type!");
     }
@@ -60,15 +172,187 @@ void Worker::process_kv_request(const KVRequest& request,
     response.set_id(request.id());
 }
 
+/* Memoized results are stored in the DB under a hash of the request
+ * and of the content of its inputs, so every replica shares them. A key
+ * deleted and put again with new content makes for a different memo. */
+static string memo_key(const string& memo)
+{
+    /* FNV-1a; a collision only costs a miss, see MemoEntry */
+    uint64_t hash = 14695981039346656037ull;
+    for (const char c : memo)
+    {
+        hash ^= (unsigned char) c;
+        hash *= 1099511628211ull;
+    }
+
+    char key[32];
+    snprintf(key, sizeof(key), "memo:%016llx", (unsigned long long) hash);
+    return key;
+}
+
+/* Sets `memo` if the result of `request` may be memoized, and answers
+ * it in `response` if it already has been */
+bool Worker::replay_memoized(const ExecRequest& request,
+                                    string& memo,
+                                    KVResponse& response)
+{
+    memo.clear();
+    if (!request.memoize())
+        return false;
+
+    /* Every input, wherever it is stored, must be immutable */
+    vector<string> inputs {request.func()};
+    inputs.insert(inputs.end(), request.file_args().begin(), request.file_args().end());
+    inputs.insert(inputs.end(), request.dict_args().begin(), request.dict_args().end());
+
+    bool immutable_inputs = true;
+    unordered_map<string, ObjectMetadata> identities;
+    db->stat(inputs,
+        [&immutable_inputs, &identities](const string& key,
+        const simpledb::storage::DbOpStatus status,
+        const ObjectMetadata& metadata)
+        {
+            if (status != simpledb::storage::DbOpStatus::STATUS_OK || !metadata.immutable())
+                immutable_inputs = false;
+            else
+                identities[key] = metadata;
+        }
+    );
+    if (!immutable_inputs)
+        return false;
+
+    MemoRequest canonical;
+    *canonical.mutable_request() = request;
+    canonical.mutable_request()->clear_memoize();
+    for (const auto& input : inputs)
+    {
+        const ObjectMetadata& metadata = identities[input];
+        auto identity = canonical.add_inputs();
+        identity->set_size(metadata.size());
+        identity->set_checksum(metadata.checksum());
+        identity->set_version(metadata.version());
+    }
+    canonical.SerializeToString(&memo);
+
+    const string key = memo_key(memo);
+    bool found = false;
+    MemoEntry entry;
+    vector<simpledb::storage::GetRequest> get_requests;
+    get_requests.emplace_back(key);
+    db->get(get_requests,
+        [&](const simpledb::storage::GetRequest&,
+        const simpledb::storage::DbOpStatus status,
+        const string& data)
+        {
+            found = status == simpledb::storage::DbOpStatus::STATUS_OK
+                && entry.ParseFromString(data) && entry.request() == memo;
+        }
+    );
+
+    if (!found)
+        return false;
+
+    /* Outputs may have been deleted since; then the entry goes too */
+    vector<string> outputs;
+    for (auto& arg : entry.response().f_output())
+        outputs.push_back(arg.key());
+    for (auto& arg : entry.response().kw_output())
+        outputs.push_back(arg.key());
+
+    bool outputs_present = true;
+    db->stat(outputs,
+        [&outputs_present](const string&,
+        const simpledb::storage::DbOpStatus status,
+        const ObjectMetadata& metadata)
+        {
+            if (status != simpledb::storage::DbOpStatus::STATUS_OK || !metadata.immutable())
+                outputs_present = false;
+        }
+    );
+
+    if (!outputs_present)
+    {
+        db->del({key});
+        return false;
+    }
+
+    response.set_return_code(entry.response().return_code());
+    response.set_val(entry.response().return_output());
+    return true;
+}
+
+/* Only successful runs whose outputs are all immutable are kept */
+void Worker::memoize(const string& memo, const ExecResponse& result)
+{
+    if (memo.empty() || result.return_code() != 0)
+        return;
+
+    MemoEntry entry;
+    entry.set_request(memo);
+    auto response = entry.mutable_response();
+    response->set_return_code(result.return_code());
+    response->set_return_output(result.return_output());
+
+    for (auto& arg : result.f_output())
+    {
+        if (!arg.immutable())
+            return;
+        response->add_f_output()->set_key(arg.key());
+    }
+    for (auto& arg : result.kw_output())
+    {
+        if (!arg.immutable())
+            return;
+        response->add_kw_output()->set_key(arg.key());
+    }
+
+    /* A concurrent run may have stored it first: that is as good */
+    vector<simpledb::storage::PutRequest> put_requests;
+    put_requests.emplace_back(memo_key(memo), entry.SerializeAsString(), true);
+    db->put(put_requests,
+        [](const simpledb::storage::PutRequest& req,
+        const simpledb::storage::DbOpStatus status)
+        {
+            if (status != simpledb::storage::DbOpStatus::STATUS_OK
+                    && status != simpledb::storage::DbOpStatus::STATUS_IMMUTABLE)
+                LOG(ERROR) << "Failed to memoize: " << req.object_key;
+        }
+    );
+}
+
+/* Files already in the exec cache are pinned right away, the others
+ * once they have been fetched; `pinned` lists one name per pin. Sets
+ * `image` for a function trusted to run in process. */
 void Worker::process_exec_request(const ExecRequest& request,
-                                    ExecArgs& cmd)
+                                    ExecArgs& cmd,
+                                    vector<string>& pinned,
+                                    string& image)
 {
-    // LOG(ERROR) << "EXEC";
+    image.clear();
+    if (inprocess_functions.count(request.func()) > 0)
+    {
+        db->stat({request.func()},
+            [&image](const string&,
+            const simpledb::storage::DbOpStatus status,
+            const ObjectMetadata& metadata)
+            {
+                if (status == simpledb::storage::DbOpStatus::STATUS_OK)
+                    image = to_string(metadata.version()) + "-"
+                            + to_string(metadata.checksum()) + "-"
+                            + to_string(metadata.size());
+            }
+        );
+    }
+
     vector<simpledb::storage::GetRequest> get_requests;
 
-    auto executable_path = roost::path(cache_path) / request.func();
+    auto executable_path = exec_cache->path_of(request.func());
     cmd.set_function(executable_path.string());
-    if (not roost::exists(executable_path, X_OK))
+    if (exec_cache->acquire(request.func()))
+    {
+        pinned.push_back(request.func());
+    }
+    else
     {
         get_requests.emplace_back(request.func(), executable_path,
                                                         0544, true);
@@ -91,10 +375,13 @@ void Worker::process_exec_request(const ExecRequest& request,
     auto fargs = cmd.mutable_fargs();
     for (auto &arg: request.file_args())
     {
-        auto file_path = roost::path(cache_path) / arg;
-        if (not roost::exists(file_path, F_OK))
+        if (exec_cache->acquire(arg))
+        {
+            pinned.push_back(arg);
+        }
+        else
         {
-            get_requests.emplace_back(arg, file_path, 0444, false);
+            get_requests.emplace_back(arg, exec_cache->path_of(arg), 0444, false);
         }
         fargs->Add()->assign(arg);
     }
@@ -108,25 +395,39 @@ void Worker::process_exec_request(const ExecRequest& request,
 #ifdef GG_DB_TIMELOG
     auto before = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
 #endif
-    db->get(get_requests,
-        [&](const simpledb::storage::GetRequest& req,
-        const simpledb::storage::DbOpStatus status,
-        const string& data)
-        {
-            if (status != simpledb::storage::DbOpStatus::STATUS_OK)
-                throw runtime_error(
-                    string("Failed to download key: ") + req.object_key
-                );
-
-            // KV Args
-            if (not req.filename.initialized())
+    try
+    {
+        db->get(get_requests,
+            [&](const simpledb::storage::GetRequest& req,
+            const simpledb::storage::DbOpStatus status,
+            const string& data)
             {
-                auto kv = cmd.add_kwargs();
-                kv->set_key(move(req.object_key));
-                kv->set_val(move(data));
+                if (status != simpledb::storage::DbOpStatus::STATUS_OK)
+                    throw runtime_error(
+                        string("Failed to download key: ") + req.object_key
+                    );
+
+                if (req.filename.initialized())
+                {
+                    exec_cache->insert(req.object_key);
+                    pinned.push_back(req.object_key);
+                }
+                else
+                {
+                    // KV Args
+                    auto kv = cmd.add_kwargs();
+                    kv->set_key(move(req.object_key));
+                    kv->set_val(move(data));
+                }
             }
-        }
-    );
+        );
+    }
+    catch (...)
+    {
+        exec_cache->release(pinned);
+        pinned.clear();
+        throw;
+    }
 #ifdef GG_DB_TIMELOG
     auto after = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
     std::cerr << "get_dependencies " << (after - before).count() << std::endl;
@@ -134,8 +435,12 @@ void Worker::process_exec_request(const ExecRequest& request,
 }
 
 void Worker::process_exec_result(const simpledb::proto::ExecResponse& result,
+                                    const vector<string>& pinned,
+                                    const string& memo,
                                     simpledb::proto::KVResponse& response)
 {
+    exec_cache->release(pinned);
+
     vector<simpledb::storage::PutRequest> put_requests;
 
     response.set_return_code(result.return_code());
@@ -180,6 +485,9 @@ void Worker::process_exec_result(const simpledb::proto::ExecResponse& result,
     auto after = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
     std::cerr << "upload_output " << (after - before).count() << std::endl;
 #endif
+
+    /* After the outputs, so a memoized result never names missing keys */
+    memoize(memo, result);
 }
 
 void Worker::process_work(uv_work_t* work)
@@ -195,17 +503,38 @@ void Worker::process_work(uv_work_t* work)
                 case KVRequest::ReqOpsCase::kGetRequest:
                 case KVRequest::ReqOpsCase::kPutRequest:
                 case KVRequest::ReqOpsCase::kDeleteRequest:
+                case KVRequest::ReqOpsCase::kMultiGetRequest:
+                case KVRequest::ReqOpsCase::kMultiPutRequest:
+                case KVRequest::ReqOpsCase::kMultiDeleteRequest:
+                case KVRequest::ReqOpsCase::kMultiStatRequest:
                     work_result = new WorkResult{work_request->id, work_request->client,
                                                     WorkResult::KV};
                     work_result->kv.set_id(work_result->id);
-                    process_kv_request(work_request->kv, work_result->kv);
+                    process_kv_request(work_request->kv, work_result->kv,
+                                        work_result->frame);
                     break;
 
                 case KVRequest::ReqOpsCase::kExecRequest:
+                {
+                    string memo;
+                    KVResponse memoized;
+                    if (replay_memoized(work_request->kv.exec_request(), memo, memoized))
+                    {
+                        work_result = new WorkResult{work_request->id, work_request->client,
+                                                        WorkResult::KV};
+                        work_result->kv = move(memoized);
+                        work_result->kv.set_id(work_result->id);
+                        work_result->memoized = true;
+                        break;
+                    }
+
                     work_result = new WorkResult{work_request->id, work_request->client,
                                                     WorkResult::EXEC};
-                    process_exec_request(work_request->kv.exec_request(), work_result->exec);
+                    work_result->memo = move(memo);
+                    process_exec_request(work_request->kv.exec_request(), work_result->exec,
+                                        work_result->pinned, work_result->image);
                     break;
+                }
 
                 default:
                     LOG(ERROR) << "Invalid Op: " << work_request->kv.ReqOps_case();
@@ -217,13 +546,18 @@ void Worker::process_work(uv_work_t* work)
             work_result = new WorkResult{work_request->id, work_request->client,
                                                         WorkResult::KV};
             work_result->kv.set_id(work_result->id);
-            process_exec_result(work_request->exec, work_result->kv);
+            process_exec_result(work_request->exec, work_request->pinned,
+                                work_request->memo, work_result->kv);
             break;
 
         default:
             throw runtime_error("Unknown work type!");
     }
 
+    /* Serialize here rather than on the event loop thread */
+    if (work_result->tag == WorkResult::KV && work_result->frame.empty())
+        ResponseFrame::serialize(work_result->kv, work_result->frame);
+
     work->data = work_result;
     delete work_request;
 }
\ No newline at end of file
@@ -39,6 +39,8 @@ struct WorkRequest
     enum {KV, EXEC} const tag;
     simpledb::proto::KVRequest kv;
     simpledb::proto::ExecResponse exec;
+    std::vector<std::string> pinned;    /* EXEC: released on completion */
+    std::string memo;                   /* EXEC: memoized under this request */
 
     ~WorkRequest() {}
 };
@@ -51,6 +53,11 @@ struct WorkResult
     enum {KV, EXEC} const tag;
     simpledb::proto::KVResponse kv;
     simpledb::proto::ExecArgs exec;
+    std::string frame;      /* KV: the response, framed for the wire */
+    std::vector<std::string> pinned;    /* EXEC: exec cache files in use */
+    std::string memo;                   /* EXEC: request to memoize, if any */
+    std::string image;                  /* EXEC: see ExecutionState::image */
+    bool memoized {false};              /* KV: an exec request, answered from memo */
 
     ~WorkResult() {}
 };
@@ -58,21 +65,37 @@ struct WorkResult
 class Worker {
 private:
     static simpledb::storage::SimpleDB* db;
-    static roost::path cache_path;
+    static simpledb::storage::DiskCache* exec_cache;
+    static std::unordered_set<std::string> inprocess_functions;
     static void process_kv_request(const simpledb::proto::KVRequest& request,
+                                    simpledb::proto::KVResponse& response,
+                                    std::string& frame);
+    static bool replay_memoized(const simpledb::proto::ExecRequest& request,
+                                    std::string& memo,
                                     simpledb::proto::KVResponse& response);
+    static void memoize(const std::string& memo,
+                                    const simpledb::proto::ExecResponse& result);
     static void process_exec_request(const simpledb::proto::ExecRequest& request,
-                                    simpledb::proto::ExecArgs& args);
+                                    simpledb::proto::ExecArgs& args,
+                                    std::vector<std::string>& pinned,
+                                    std::string& image);
     static void process_exec_result(const simpledb::proto::ExecResponse& result,
+                                    const std::vector<std::string>& pinned,
+                                    const std::string& memo,
                                     simpledb::proto::KVResponse& response);
 public:
     Worker(const simpledb::storage::SimpleDBConfig& config)
     {
         db = new simpledb::storage::SimpleDB(config);
-        cache_path = config.db_ / "cache";
+        exec_cache = new simpledb::storage::DiskCache(config.db_ / "cache",
+                                                    config.exec_cache_size,
+                                                    config.exec_cache_policy);
+        inprocess_functions = config.inprocess_functions;
     }
     ~Worker()
     {
+        if (exec_cache != nullptr)
+            delete exec_cache;
         if (db != nullptr)
             delete db;
     }
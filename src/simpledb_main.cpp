@@ -61,6 +61,14 @@ int main(int argc, char* argv[])
     config.backend_cache_size = 100 * 1024 * 1024; // 100 M
     config.immutable_cache_size = 100 * 1024 * 1024; // 100 M
 
+    /* Comma-separated keys of shared objects trusted to run in process */
+    const char* inprocess = getenv("SIMPLEDB_INPROCESS_FUNCTIONS");
+    if (inprocess != nullptr && *inprocess != '\0')
+    {
+        for (auto &key : split(inprocess, ","))
+            config.inprocess_functions.insert(key);
+    }
+
     uv_loop_t* execution_loop = uv_default_loop();
     Worker worker_(config);
     ServerState server(execution_loop,
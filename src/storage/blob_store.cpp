@@ -0,0 +1,272 @@
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <glog/logging.h>
+
+#include "storage/blob_store.h"
+#include "util/exception.h"
+#include "util/file_descriptor.h"
+#include "util/temp_file.h"
+#include "util/crc32c.h"
+
+using namespace std;
+using namespace simpledb::storage;
+
+static const string TMP_PREFIX { "tmp" };
+static constexpr size_t COPY_CHUNK_SIZE = 1024 * 1024;
+
+static bool parse_id(const string& name, uint64_t& id)
+{
+    if (name.length() != 16)
+        return false;
+
+    char* end = nullptr;
+    id = strtoull(name.c_str(), &end, 16);
+    return *end == '\0' && id != 0;
+}
+
+/* Copy `size` bytes between two files, sharing extents when possible */
+static void copy_content(const int src_fd, const int dst_fd, const off_t size)
+{
+    if (ioctl(dst_fd, FICLONE, src_fd) == 0)
+        return;
+
+    off_t copied = 0;
+    while (copied < size)
+    {
+        ssize_t n = copy_file_range(src_fd, nullptr, dst_fd, nullptr,
+                                    size - copied, 0);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (copied == 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL))
+                break;
+            throw unix_error("copy_file_range");
+        }
+        if (n == 0)
+            throw runtime_error("copy_file_range: unexpected end of file");
+
+        copied += n;
+    }
+
+    if (copied == size)
+        return;
+
+    /* No in-kernel copy between these files: go through userspace */
+    string buffer(COPY_CHUNK_SIZE, 0);
+    while (copied < size)
+    {
+        ssize_t n = CheckSystemCall("pread", pread(src_fd, &buffer[0],
+                        min<off_t>(buffer.length(), size - copied), copied));
+        if (n == 0)
+            throw runtime_error("pread: unexpected end of file");
+
+        for (ssize_t written = 0; written < n; )
+            written += CheckSystemCall("write",
+                            ::write(dst_fd, buffer.data() + written, n - written));
+        copied += n;
+    }
+}
+
+BlobStore::BlobStore(const roost::path& dir, const bool sync, const uint64_t min_id)
+    : dir_(dir), sync_(sync)
+{
+    roost::create_directories(dir_);
+
+    uint64_t max_id = 0;
+    for (const auto& name : roost::get_directory_listing(dir_))
+    {
+        uint64_t id;
+        if (parse_id(name, id))
+        {
+            max_id = max(max_id, id);
+        }
+        else if (name.compare(0, TMP_PREFIX.length(), TMP_PREFIX) == 0)
+        {
+            /* Left behind by a write that never completed */
+            roost::remove(dir_ / name);
+        }
+    }
+
+    first_id_ = max(max_id + 1, min_id);
+    next_id_ = first_id_;
+}
+
+roost::path BlobStore::path_of(const uint64_t id) const
+{
+    char name[17];
+    snprintf(name, sizeof(name), "%016lx", static_cast<unsigned long>(id));
+    return dir_ / name;
+}
+
+uint64_t BlobStore::commit_file(const string& tmp_name, const int fd)
+{
+    if (sync_)
+        CheckSystemCall("fsync", fsync(fd));
+
+    const uint64_t id = next_id_++;
+    roost::rename(tmp_name, path_of(id));
+
+    if (sync_)
+    {
+        FileDescriptor dir { CheckSystemCall("open " + dir_.string(),
+                                open(dir_.string().c_str(), O_RDONLY | O_DIRECTORY)) };
+        CheckSystemCall("fsync", fsync(dir.fd_num()));
+    }
+
+    return id;
+}
+
+uint64_t BlobStore::write(const string& data, const mode_t mode)
+{
+    UniqueFile tmp_file { (dir_ / TMP_PREFIX).string() };
+
+    if (data.size() > 0)
+        tmp_file.fd().write(data);
+    CheckSystemCall("fchmod", fchmod(tmp_file.fd().fd_num(), mode));
+
+    return commit_file(tmp_file.name(), tmp_file.fd().fd_num());
+}
+
+uint64_t BlobStore::import(const roost::path& filename, const mode_t mode,
+                        uint64_t& size, uint32_t& checksum)
+{
+    FileDescriptor src { CheckSystemCall("open " + filename.string(),
+                            open(filename.string().c_str(), O_RDONLY)) };
+    UniqueFile tmp_file { (dir_ / TMP_PREFIX).string() };
+
+    size = 0;
+    checksum = 0;
+    while (not src.eof())
+    {
+        const string chunk = src.read(COPY_CHUNK_SIZE);
+        checksum = crc32c(chunk.data(), chunk.length(), checksum);
+        size += chunk.length();
+        if (chunk.size() > 0)
+            tmp_file.fd().write(chunk);
+    }
+    CheckSystemCall("fchmod", fchmod(tmp_file.fd().fd_num(), mode));
+
+    return commit_file(tmp_file.name(), tmp_file.fd().fd_num());
+}
+
+static void pread_exactly(const int fd, char* dst, const size_t length,
+                        const uint64_t offset)
+{
+    for (size_t done = 0; done < length; )
+    {
+        ssize_t n = CheckSystemCall("pread", pread(fd, dst + done,
+                                            length - done, offset + done));
+        if (n == 0)
+            throw runtime_error("pread: unexpected end of blob");
+        done += n;
+    }
+}
+
+string BlobStore::read(const uint64_t id, const uint64_t offset, const size_t length) const
+{
+    const roost::path path = path_of(id);
+    FileDescriptor file { CheckSystemCall("open " + path.string(),
+                            open(path.string().c_str(), O_RDONLY)) };
+
+    struct stat info;
+    CheckSystemCall("fstat", fstat(file.fd_num(), &info));
+
+    const uint64_t file_size = info.st_size;
+    if (offset >= file_size)
+        return {};
+
+    string data(min<uint64_t>(length, file_size - offset), 0);
+    pread_exactly(file.fd_num(), &data[0], data.length(), offset);
+    return data;
+}
+
+void BlobStore::read_into(const uint64_t id, char* dst, const size_t length,
+                        const uint64_t offset) const
+{
+    const roost::path path = path_of(id);
+    FileDescriptor file { CheckSystemCall("open " + path.string(),
+                            open(path.string().c_str(), O_RDONLY)) };
+
+    pread_exactly(file.fd_num(), dst, length, offset);
+}
+
+void BlobStore::materialize(const uint64_t id, const roost::path& dst,
+                            const bool set_mode, const mode_t mode,
+                            const bool allow_link) const
+{
+    clone_file(path_of(id), dst, set_mode, mode, allow_link);
+}
+
+void simpledb::storage::clone_file(const roost::path& src_path, const roost::path& dst,
+                                const bool set_mode, const mode_t mode,
+                                const bool allow_link)
+{
+    FileDescriptor src { CheckSystemCall("open " + src_path.string(),
+                            open(src_path.string().c_str(), O_RDONLY)) };
+
+    struct stat info;
+    CheckSystemCall("fstat", fstat(src.fd_num(), &info));
+
+    if (allow_link && (not set_mode || (info.st_mode & 07777) == mode))
+    {
+        /* Link under a fresh name and rename it over `dst` */
+        string tmp_name;
+        {
+            UniqueFile tmp_file { dst.string() };
+            tmp_name = tmp_file.name();
+        }
+        roost::remove(tmp_name);
+
+        if (link(src_path.string().c_str(), tmp_name.c_str()) == 0)
+        {
+            roost::rename(tmp_name, dst);
+            return;
+        }
+
+        if (errno != EXDEV && errno != EPERM && errno != EMLINK)
+            throw unix_error("link " + src_path.string());
+    }
+
+    string tmp_name;
+    {
+        UniqueFile tmp_file { dst.string() };
+        tmp_name = tmp_file.name();
+
+        copy_content(src.fd_num(), tmp_file.fd().fd_num(), info.st_size);
+        CheckSystemCall("fchmod", fchmod(tmp_file.fd().fd_num(),
+                                    set_mode ? mode : (info.st_mode & 07777)));
+    }
+
+    roost::rename(tmp_name, dst);
+}
+
+void BlobStore::remove(const uint64_t id) const
+{
+    const roost::path path = path_of(id);
+    if (unlink(path.string().c_str()) < 0 && errno != ENOENT)
+        LOG(ERROR) << "Failed to remove blob " << path.string() << ": " << strerror(errno);
+}
+
+vector<uint64_t> BlobStore::list_preexisting() const
+{
+    vector<uint64_t> ids;
+    for (const auto& name : roost::get_directory_listing(dir_))
+    {
+        uint64_t id;
+        if (parse_id(name, id) && id < first_id_)
+            ids.push_back(id);
+    }
+
+    return ids;
+}
@@ -0,0 +1,72 @@
+#ifndef SIMPLEDB_BLOB_STORE_H
+#define SIMPLEDB_BLOB_STORE_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <sys/types.h>
+
+#include "util/path.h"
+
+namespace simpledb::storage
+{
+    /* Atomically create `dst` with the content of `src`. Hard links it
+     * when `allow_link` is set and the modes agree, otherwise tries a
+     * reflink and falls back to copy_file_range. */
+    void clone_file(const roost::path& src, const roost::path& dst,
+                    const bool set_mode, const mode_t mode,
+                    const bool allow_link);
+
+    /* Large values kept outside LevelDB: one read-only file per blob
+     * under `dir`, named after an id that is never reused. LevelDB only
+     * stores the id, so compactions never rewrite blob bytes. Files are
+     * complete once they carry their final name; deciding when a blob
+     * is garbage is left to the owner. */
+    class BlobStore
+    {
+    private:
+        const roost::path dir_;
+        const bool sync_;
+        std::atomic<uint64_t> next_id_ {1};
+        uint64_t first_id_ {1};
+
+        roost::path path_of(const uint64_t id) const;
+        uint64_t commit_file(const std::string& tmp_name, const int fd);
+
+    public:
+        /* Ids below `min_id` are never handed out, whatever is on disk */
+        BlobStore(const roost::path& dir, const bool sync, const uint64_t min_id = 1);
+
+        BlobStore(const BlobStore&) = delete;
+        BlobStore& operator=(const BlobStore&) = delete;
+
+        /* Store a new blob and return its id */
+        uint64_t write(const std::string& data, const mode_t mode);
+
+        /* Store a copy of `filename`, computing its size and CRC-32C on
+         * the way through */
+        uint64_t import(const roost::path& filename, const mode_t mode,
+                        uint64_t& size, uint32_t& checksum);
+
+        /* Read `length` bytes starting at `offset` (to the end by default) */
+        std::string read(const uint64_t id, const uint64_t offset = 0,
+                        const size_t length = SIZE_MAX) const;
+
+        /* Read exactly `length` bytes starting at `offset` into `dst` */
+        void read_into(const uint64_t id, char* dst, const size_t length,
+                        const uint64_t offset = 0) const;
+
+        /* Atomically create `dst` with the blob's content (see clone_file) */
+        void materialize(const uint64_t id, const roost::path& dst,
+                        const bool set_mode, const mode_t mode,
+                        const bool allow_link) const;
+
+        void remove(const uint64_t id) const;
+
+        /* Ids of blobs that were already on disk when the store was
+         * opened; blobs written since then are never listed. */
+        std::vector<uint64_t> list_preexisting() const;
+    };
+}
+
+#endif /* SIMPLEDB_BLOB_STORE_H */
@@ -1,54 +1,306 @@
+#include <thread>
+#include <algorithm>
+
 #include "storage/cache.h"
 
 using namespace std;
 using namespace simpledb::storage;
 
-bool Cache::access(const string& key, string& val)
+/* Smallest capacity a shard is split down to when sizing automatically */
+static constexpr size_t MIN_SHARD_CAPACITY = 16 * 1024 * 1024;
+
+/* W-TinyLFU layout: the window takes 1% of a shard, the protected
+ * segment 80% of the rest. The sketch gets one counter per
+ * SKETCH_BYTES_PER_COUNTER bytes of capacity. */
+static constexpr size_t WINDOW_PERCENT = 1;
+static constexpr size_t PROTECTED_PERCENT = 80;
+static constexpr size_t SKETCH_BYTES_PER_COUNTER = 1024;
+static constexpr size_t SKETCH_MIN_WIDTH = 1024;
+static constexpr size_t SKETCH_MAX_WIDTH = 1 << 22;
+
+/* Heap bytes behind a string, beyond the string object itself */
+static inline size_t heap_bytes(const string& s)
 {
-    const lock_guard<mutex> lguard(lock_);
+    return (s.capacity() > string().capacity()) ? s.capacity() + 1 : 0;
+}
 
-    unordered_map<string, list<pair<string, string>>::iterator>::iterator it;
-    if ((it = lru_lookup_.find(key)) == lru_lookup_.end())
-        return false;
+size_t Cache::charge(const string& key, const string& val)
+{
+    /* List node (two links and the entry), map node (next link, cached
+     * hash, key copy and iterator) plus its bucket slot, and the
+     * make_shared block holding the value string. */
+    static constexpr size_t ENTRY_OVERHEAD =
+            2 * sizeof(void*) + sizeof(Entry)
+            + 3 * sizeof(void*) + sizeof(size_t)
+                + sizeof(pair<const string, LRUList::iterator>)
+            + 2 * sizeof(long) + sizeof(string);
 
-    val = it->second->second;
-    lru_cache_.erase(it->second);
-    lru_cache_.push_front(make_pair(key, val));
-    lru_lookup_[key] = lru_cache_.begin();
+    return ENTRY_OVERHEAD + 2 * heap_bytes(key) + heap_bytes(val);
+}
 
-    return true;
+static unsigned floor_log2(size_t n)
+{
+    unsigned bits = 0;
+    while (n >>= 1)
+        bits++;
+    return bits;
 }
 
-void Cache::insert(const string& key, const string& val)
+void Cache::FrequencySketch::resize(const size_t width)
 {
-    const lock_guard<mutex> lguard(lock_);
+    const size_t w = size_t(1) << floor_log2(max<size_t>(width, 1));
+    counters_.assign(4 * w, 0);
+    mask_ = w - 1;
+    additions_ = 0;
+}
 
-    const auto len = key.length() + val.length();
+size_t Cache::FrequencySketch::index(const uint64_t hash, const unsigned row) const
+{
+    /* Double hashing off the key hash, one independent probe per row */
+    const uint64_t h2 = (hash >> 32) * 0xC2B2AE3D27D4EB4Full | 1;
+    return row * (mask_ + 1) + ((hash + row * h2) & mask_);
+}
 
-    if (len > capacity_)
-        return;
+void Cache::FrequencySketch::increment(const uint64_t hash)
+{
+    for (unsigned row = 0; row < 4; row++)
+    {
+        uint8_t& counter = counters_[index(hash, row)];
+        if (counter < 15)
+            counter++;
+    }
 
-    while (size_ + len > capacity_)
+    if (++additions_ >= 10 * (mask_ + 1))
     {
-        auto &drop = lru_cache_.back();
-        size_ -= drop.first.length() + drop.second.length();
+        for (auto& counter : counters_)
+            counter >>= 1;
+        additions_ /= 2;
+    }
+}
+
+unsigned Cache::FrequencySketch::estimate(const uint64_t hash) const
+{
+    unsigned frequency = 15;
+    for (unsigned row = 0; row < 4; row++)
+        frequency = min<unsigned>(frequency, counters_[index(hash, row)]);
 
-        lru_lookup_.erase(drop.first);
-        lru_cache_.pop_back();
+    return frequency;
+}
+
+Cache::Cache(const size_t capacity, const size_t shards, const CachePolicy policy)
+    : capacity_(capacity), policy_(policy)
+{
+    if (shards > 0)
+    {
+        shard_bits_ = floor_log2(shards);
+    }
+    else
+    {
+        const size_t cores = max(thread::hardware_concurrency(), 1u);
+        shard_bits_ = min(floor_log2(cores * 2 - 1),
+                        floor_log2(max<size_t>(capacity_ / MIN_SHARD_CAPACITY, 1)));
     }
 
-    lru_cache_.push_front(make_pair(key, val));
-    lru_lookup_[key] = lru_cache_.begin();
+    shard_capacity_ = capacity_ >> shard_bits_;
+    shards_ = make_unique<Shard[]>(shard_count());
+
+    if (policy_ == CachePolicy::LRU)
+    {
+        window_capacity_ = shard_capacity_;
+        protected_capacity_ = 0;
+    }
+    else
+    {
+        window_capacity_ = shard_capacity_ * WINDOW_PERCENT / 100;
+        protected_capacity_ = (shard_capacity_ - window_capacity_) * PROTECTED_PERCENT / 100;
+
+        const size_t width = min(max(shard_capacity_ / SKETCH_BYTES_PER_COUNTER,
+                                    SKETCH_MIN_WIDTH), SKETCH_MAX_WIDTH);
+        for (size_t idx = 0; idx < shard_count(); idx++)
+            shards_[idx].sketch.resize(width);
+    }
 }
 
-void Cache::drop(const string& key)
+Cache::Shard& Cache::shard_for(const uint64_t hash)
+{
+    if (shard_bits_ == 0)
+        return shards_[0];
+
+    /* Fibonacci hashing: take the top bits so that the shard index is
+     * independent of the bucket the shard's own map puts the key in */
+    return shards_[(hash * 0x9E3779B97F4A7C15ull) >> (64 - shard_bits_)];
+}
+
+Cache::Stats Cache::stats() const
+{
+    Stats stats;
+    stats.capacity = capacity_;
+
+    for (size_t idx = 0; idx < shard_count(); idx++)
+    {
+        Shard& shard = shards_[idx];
+        const lock_guard<mutex> lguard(shard.lock);
+
+        stats.resident_bytes += shard.size;
+        stats.entries += shard.lru_lookup.size();
+        stats.hits += shard.hits;
+        stats.misses += shard.misses;
+        stats.inserts += shard.inserts;
+        stats.evictions += shard.evictions;
+        stats.rejected += shard.rejected;
+    }
+
+    return stats;
+}
+
+size_t Cache::size() const
+{
+    size_t total = 0;
+    for (size_t idx = 0; idx < shard_count(); idx++)
+    {
+        const lock_guard<mutex> lguard(shards_[idx].lock);
+        total += shards_[idx].size;
+    }
+
+    return total;
+}
+
+void Cache::erase(Shard& shard, LRUList::iterator it, const bool evicted)
+{
+    shard.size -= it->charge;
+    shard.sizes[it->segment] -= it->charge;
+    if (evicted)
+        shard.evictions++;
+
+    shard.lru_lookup.erase(it->key);
+    shard.lists[it->segment].erase(it);
+}
+
+void Cache::move_to(Shard& shard, LRUList::iterator it, const Segment segment)
+{
+    /* Splicing between lists keeps the map's iterator valid */
+    shard.sizes[it->segment] -= it->charge;
+    shard.sizes[segment] += it->charge;
+    shard.lists[segment].splice(shard.lists[segment].begin(),
+                                shard.lists[it->segment], it);
+    it->segment = segment;
+}
+
+void Cache::make_room(Shard& shard)
+{
+    while (!shard.lists[WINDOW].empty() &&
+            (shard.sizes[WINDOW] > window_capacity_ || shard.size > shard_capacity_))
+    {
+        auto candidate = prev(shard.lists[WINDOW].end());
+
+        if (policy_ == CachePolicy::LRU)
+        {
+            erase(shard, candidate, true);
+            continue;
+        }
+
+        /* The window's victim competes for a place in the main segment
+         * against whatever that segment would have to give up for it */
+        move_to(shard, candidate, PROBATION);
+
+        while (shard.size > shard_capacity_)
+        {
+            LRUList::iterator victim;
+            if (shard.lists[PROBATION].size() > 1)
+                victim = prev(shard.lists[PROBATION].end());
+            else if (!shard.lists[PROTECTED].empty())
+                victim = prev(shard.lists[PROTECTED].end());
+            else
+                victim = candidate;
+
+            if (victim == candidate ||
+                shard.sketch.estimate(candidate->hash) <= shard.sketch.estimate(victim->hash))
+            {
+                erase(shard, candidate, false);
+                shard.rejected++;
+                break;
+            }
+
+            erase(shard, victim, true);
+        }
+    }
+}
+
+Cache::Value Cache::access(const string& key)
 {
-    const lock_guard<mutex> lguard(lock_);
+    const uint64_t hash = std::hash<string>{}(key);
+    Shard& shard = shard_for(hash);
+    const lock_guard<mutex> lguard(shard.lock);
+
+    if (policy_ == CachePolicy::TINY_LFU)
+        shard.sketch.increment(hash);
+
+    auto it = shard.lru_lookup.find(key);
+    if (it == shard.lru_lookup.end())
+    {
+        shard.misses++;
+        return nullptr;
+    }
+
+    shard.hits++;
 
-    unordered_map<string, list<pair<string, string>>::iterator>::iterator it;
-    if ((it = lru_lookup_.find(key)) == lru_lookup_.end())
+    auto entry = it->second;
+    if (entry->segment == PROBATION)
+    {
+        /* Second hit in the main segment: protect it, demoting the
+         * least recently used protected entries to make space */
+        move_to(shard, entry, PROTECTED);
+        while (shard.sizes[PROTECTED] > protected_capacity_)
+            move_to(shard, prev(shard.lists[PROTECTED].end()), PROBATION);
+    }
+    else
+    {
+        move_to(shard, entry, entry->segment);
+    }
+
+    return entry->val;
+}
+
+void Cache::insert(const string& key, Value val)
+{
+    if (!val)
         return;
 
-    lru_cache_.erase(it->second);
-    lru_lookup_.erase(key);
-}
\ No newline at end of file
+    const size_t len = charge(key, *val);
+    const uint64_t hash = std::hash<string>{}(key);
+
+    Shard& shard = shard_for(hash);
+    const lock_guard<mutex> lguard(shard.lock);
+
+    /* The old value goes either way, it must not be served after this */
+    auto it = shard.lru_lookup.find(key);
+    if (it != shard.lru_lookup.end())
+        erase(shard, it->second, false);
+
+    if (len > shard_capacity_)
+    {
+        shard.rejected++;
+        return;
+    }
+
+    if (policy_ == CachePolicy::TINY_LFU)
+        shard.sketch.increment(hash);
+
+    shard.lists[WINDOW].push_front(Entry{key, move(val), len, hash, WINDOW});
+    shard.lru_lookup[key] = shard.lists[WINDOW].begin();
+    shard.sizes[WINDOW] += len;
+    shard.size += len;
+    shard.inserts++;
+
+    make_room(shard);
+}
+
+void Cache::drop(const string& key)
+{
+    Shard& shard = shard_for(std::hash<string>{}(key));
+    const lock_guard<mutex> lguard(shard.lock);
+
+    auto it = shard.lru_lookup.find(key);
+    if (it != shard.lru_lookup.end())
+        erase(shard, it->second, false);
+}
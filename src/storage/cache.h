@@ -3,29 +3,137 @@
 
 #include <string>
 #include <list>
+#include <vector>
 #include <mutex>
+#include <memory>
 #include <unordered_map>
 
 namespace simpledb::storage
 {
+    enum class CachePolicy
+    {
+        LRU,
+        TINY_LFU
+    };
 
+    /* Cache split into a power-of-two number of shards, each with its
+     * own lock, lists and share of the capacity. Keys are mapped to
+     * shards by hash, so threads touching different keys rarely contend.
+     * An entry larger than a shard's capacity is not cached. Values are
+     * immutable, reference-counted buffers: a hit hands out another
+     * reference instead of copying the payload, and stays valid after
+     * the entry has been evicted.
+     *
+     * Capacity bounds resident bytes: every entry is charged for the
+     * heap memory of its key and value plus the bookkeeping around them
+     * (list and map nodes, the key copy, the value's control block).
+     * Buffers still referenced by callers after eviction are not
+     * counted.
+     *
+     * CachePolicy::LRU is a plain LRU. CachePolicy::TINY_LFU is
+     * W-TinyLFU: new entries go to a small LRU window; entries leaving
+     * the window only enter the main segmented LRU if a count-min sketch
+     * of recent accesses says they are used more often than the entry
+     * they would displace, so one-shot scans cannot flush the hot set. */
     class Cache {
+    public:
+        typedef std::shared_ptr<const std::string> Value;
+
+        struct Stats
+        {
+            size_t capacity {0};
+            size_t resident_bytes {0};
+            size_t entries {0};
+            uint64_t hits {0};
+            uint64_t misses {0};
+            uint64_t inserts {0};
+            uint64_t evictions {0};     /* pushed out to make room */
+            uint64_t rejected {0};      /* too large, or lost admission */
+        };
+
+        /* Bytes an entry is charged for */
+        static size_t charge(const std::string& key, const std::string& val);
+
     private:
+        enum Segment { WINDOW, PROBATION, PROTECTED, SEGMENTS };
+
+        struct Entry
+        {
+            std::string key;
+            Value val;
+            size_t charge;
+            uint64_t hash;
+            Segment segment;
+        };
+
+        typedef std::list<Entry> LRUList;
+
+        /* 4-bit counters in four rows; every count is halved once the
+         * number of increments reaches ten times the width, so that the
+         * sketch follows recent popularity. */
+        class FrequencySketch
+        {
+        private:
+            std::vector<uint8_t> counters_;
+            size_t mask_ {0};
+            size_t additions_ {0};
+
+            size_t index(const uint64_t hash, const unsigned row) const;
+
+        public:
+            void resize(const size_t width);
+            void increment(const uint64_t hash);
+            unsigned estimate(const uint64_t hash) const;
+        };
+
+        struct alignas(64) Shard
+        {
+            std::mutex lock;
+            size_t size {0};
+            LRUList lists[SEGMENTS];
+            size_t sizes[SEGMENTS] {};
+            std::unordered_map<std::string, LRUList::iterator> lru_lookup;
+            FrequencySketch sketch;
+
+            uint64_t hits {0};
+            uint64_t misses {0};
+            uint64_t inserts {0};
+            uint64_t evictions {0};
+            uint64_t rejected {0};
+        };
+
         const size_t capacity_;
-        size_t size_ {0};
-        std::list<std::pair<std::string, std::string>> lru_cache_;
-        std::unordered_map<std::string, std::list<std::pair<std::string, std::string>>::iterator> lru_lookup_;
-        std::mutex lock_;
+        const CachePolicy policy_;
+        unsigned shard_bits_;
+        size_t shard_capacity_;
+        size_t window_capacity_;
+        size_t protected_capacity_;
+        std::unique_ptr<Shard[]> shards_;
+
+        Shard& shard_for(const uint64_t hash);
+        void erase(Shard& shard, LRUList::iterator it, const bool evicted);
+        void move_to(Shard& shard, LRUList::iterator it, const Segment segment);
+        void make_room(Shard& shard);
+
     public:
-        Cache(const size_t capacity): capacity_(capacity) {}
+        /* shards == 0 picks a count from the number of cores, keeping
+         * every shard large enough to hold multi-megabyte objects */
+        Cache(const size_t capacity, const size_t shards = 0,
+                const CachePolicy policy = CachePolicy::LRU);
         ~Cache() {}
-        size_t size() const { return size_; }
+
+        /* Resident bytes */
+        size_t size() const;
         size_t capacity() const { return capacity_; }
+        size_t shard_count() const { return size_t(1) << shard_bits_; }
+        CachePolicy policy() const { return policy_; }
+        Stats stats() const;
 
-        bool access(const std::string& key, std::string& val);
-        void insert(const std::string& key, const std::string& val);
+        /* nullptr on a miss */
+        Value access(const std::string& key);
+        void insert(const std::string& key, Value val);
         void drop(const std::string& key);
     };
 }
 
-#endif /* SIMPLEDB_CACHE_HH */
\ No newline at end of file
+#endif /* SIMPLEDB_CACHE_HH */
@@ -0,0 +1,74 @@
+#include <string>
+#include <exception>
+#include <unistd.h>
+#include <errno.h>
+
+#include <glog/logging.h>
+
+#include "storage/content_store.h"
+#include "storage/blob_store.h"
+#include "util/exception.h"
+
+using namespace std;
+using namespace simpledb::storage;
+
+ContentStore::ContentStore(const roost::path& dir, const size_t capacity)
+    : files_(dir, capacity)
+{
+}
+
+bool ContentStore::materialize(const string& object_key, const roost::path& dst,
+                            const bool set_mode, const mode_t mode)
+{
+    if (!files_.acquire(object_key))
+        return false;
+
+    bool done = true;
+    try
+    {
+        clone_file(files_.path_of(object_key), dst, set_mode, mode, true);
+    }
+    catch (const exception& e)
+    {
+        LOG(ERROR) << "Materialize Key=" << object_key << " from store Error: " << e.what();
+        done = false;
+    }
+
+    files_.release({object_key});
+    if (!done)
+        files_.remove(object_key);
+
+    return done;
+}
+
+void ContentStore::adopt(const string& object_key, const roost::path& src)
+{
+    const roost::path dst = files_.path_of(object_key);
+
+    try
+    {
+        if (link(src.string().c_str(), dst.string().c_str()) < 0)
+        {
+            /* Already there: same key, same content */
+            if (errno == EEXIST)
+                return;
+            if (errno != EXDEV && errno != EPERM && errno != EMLINK)
+                throw unix_error("link " + src.string());
+
+            clone_file(src, dst, false, 0, false);
+        }
+    }
+    catch (const exception& e)
+    {
+        LOG(ERROR) << "Store Key=" << object_key << " Error: " << e.what();
+        return;
+    }
+
+    files_.insert(object_key);
+    files_.release({object_key});
+}
+
+void ContentStore::remove(const string& object_key)
+{
+    files_.remove(object_key);
+}
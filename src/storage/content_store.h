@@ -0,0 +1,42 @@
+#ifndef SIMPLEDB_CONTENT_STORE_H
+#define SIMPLEDB_CONTENT_STORE_H
+
+#include <string>
+#include <sys/types.h>
+
+#include "util/path.h"
+#include "storage/disk_cache.h"
+
+namespace simpledb::storage
+{
+    /* One read-only file per immutable object, named after its key, so
+     * that writing an object to a file a second time is a hard link (or
+     * a reflink, or an in-kernel copy) of the first. Files join the
+     * store by being linked in right after they were written elsewhere,
+     * and are evicted like any DiskCache. */
+    class ContentStore
+    {
+    private:
+        DiskCache files_;
+
+    public:
+        ContentStore(const roost::path& dir, const size_t capacity);
+
+        ContentStore(const ContentStore&) = delete;
+        ContentStore& operator=(const ContentStore&) = delete;
+
+        DiskCache::Stats stats() const { return files_.stats(); }
+
+        /* Atomically create `dst` with the object's content; false if
+         * the object is not stored */
+        bool materialize(const std::string& object_key, const roost::path& dst,
+                        const bool set_mode, const mode_t mode);
+
+        /* Keep `src`, just written with the object's content, for later */
+        void adopt(const std::string& object_key, const roost::path& src);
+
+        void remove(const std::string& object_key);
+    };
+}
+
+#endif /* SIMPLEDB_CONTENT_STORE_H */
@@ -1,12 +1,18 @@
 #include <string>
+#include <deque>
+#include <algorithm>
+#include <unordered_set>
+#include <unordered_map>
+#include <memory>
+#include <chrono>
 #include <sstream>
 #include <exception>
-#include <thread>
 #include <atomic>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <climits>
+#include <cstring>
 #include <errno.h>
 
 #include <glog/logging.h>
@@ -14,46 +20,129 @@
 
 #include "leveldb/db.h"
 #include "leveldb/cache.h"
+#include "leveldb/write_batch.h"
+#include "leveldb/iterator.h"
 #include "formats/serialization.pb.h"
 #include "formats/netformats.pb.h"
 
 #include "storage/db.h"
 #include "util/exception.h"
 #include "util/crc16.h"
+#include "util/crc32c.h"
 
 #include "config.h"
 
 using namespace simpledb::storage;
 using namespace std;
 
-static inline void send_request(TCPSocket* socket, simpledb::proto::KVRequest& req)
+/* Storage layout: each object is kept as two records, a small
+ * ObjectMetadata under METADATA_PREFIX + key and the raw content under
+ * CONTENT_PREFIX + key, so flag checks never read the content. Objects
+ * written before the split live under the bare key as a FileMetadata;
+ * they stay readable and are migrated on their next write.
+ * Large contents go to the blob tier instead of CONTENT_PREFIX. Blobs
+ * that lose their last reference get a GC_PREFIX + id record, holding
+ * the time of death, in the same batch that drops the reference. */
+static const string METADATA_PREFIX { "\x01" "m" };
+static const string CONTENT_PREFIX { "\x01" "c" };
+static const string GC_PREFIX { "\x01" "g" };
+
+static inline string metadata_key(const string& object_key)
 {
-    std::string req_s = req.SerializeAsString();
-    size_t len = req_s.length();
-    static size_t slen = (ssize_t) sizeof(size_t);
+    return METADATA_PREFIX + object_key;
+}
 
-    socket->write(string((char*) &len, slen));
-    socket->write(req_s);
+static inline string content_key(const string& object_key)
+{
+    return CONTENT_PREFIX + object_key;
 }
 
-static inline bool receive_response(TCPSocket* socket, simpledb::proto::KVResponse& resp)
+static inline string gc_key(const uint64_t blob_id)
 {
-    size_t len;
-    const static size_t slen = sizeof(size_t);
+    char id[17];
+    snprintf(id, sizeof(id), "%016lx", static_cast<unsigned long>(blob_id));
+    return GC_PREFIX + id;
+}
 
-    len = *((size_t*) (&socket->read_exactly(slen)[0]));
+static inline uint64_t gc_blob_id(const leveldb::Slice& key)
+{
+    return strtoull(key.ToString().c_str() + GC_PREFIX.length(), nullptr, 16);
+}
 
-    string data = move(socket->read_exactly(len));
-    google::protobuf::io::CodedInputStream istream((const uint8_t*) data.c_str(), data.length());
-    istream.SetTotalBytesLimit(INT_MAX, INT_MAX);
-    if (!resp.ParseFromCodedStream(&istream))
-        return false;
+/* Blob ids that some object's metadata points to */
+static unordered_set<uint64_t> referenced_blobs(leveldb::Iterator* it)
+{
+    unordered_set<uint64_t> live;
+    for (it->Seek(METADATA_PREFIX); it->Valid() && it->key().starts_with(METADATA_PREFIX); it->Next())
+    {
+        simpledb::proto::ObjectMetadata metadata;
+        if (metadata.ParseFromArray(it->value().data(), it->value().size())
+                && metadata.blob_id() != 0)
+            live.insert(metadata.blob_id());
+    }
 
-    return true;
+    return live;
+}
+
+static inline string now_seconds()
+{
+    return to_string(chrono::duration_cast<chrono::seconds>(
+                chrono::system_clock::now().time_since_epoch()).count());
+}
+
+static string read_object_file(const roost::path& filename)
+{
+    string content;
+    FileDescriptor file {
+        CheckSystemCall("open " + filename.string(),
+            open(filename.string().c_str(), O_RDONLY))
+    };
+    while (not file.eof())
+        { content.append(file.read()); }
+    file.close();
+
+    return content;
+}
+
+/* Split [0, count) into runs of at most max_keys entries, closing a run
+ * early once its known payload reaches max_bytes. Each run becomes one
+ * multi-key request on the wire. */
+static vector<pair<size_t, size_t>> make_runs(const size_t count,
+                                        const size_t max_keys,
+                                        const size_t max_bytes,
+                                        const function<size_t(const size_t)>& size_of
+                                            = [](const size_t) { return 0; })
+{
+    vector<pair<size_t, size_t>> runs;
+    size_t begin = 0, bytes = 0;
+
+    for (size_t idx = 0; idx < count; idx++)
+    {
+        bytes += size_of(idx);
+
+        if (idx + 1 - begin >= max_keys || bytes >= max_bytes)
+        {
+            runs.emplace_back(begin, idx + 1);
+            begin = idx + 1;
+            bytes = 0;
+        }
+    }
+
+    if (begin < count)
+        runs.emplace_back(begin, count);
+
+    return runs;
 }
 
 SimpleDB::SimpleDB(const SimpleDBConfig& config)
-    : config_(config), db(nullptr), conns_(config.num_, nullptr), immutable_object_cache_(config.immutable_cache_size)
+    : config_(config), db(nullptr), pools_(config.num_),
+        remote_(config.pipeline_depth, config.pipeline_bytes),
+        immutable_object_cache_(config.immutable_cache_size,
+                                config.immutable_cache_shards,
+                                config.immutable_cache_policy),
+        local_object_cache_(config.local_cache_size, 0,
+                            config.local_cache_policy),
+        negative_cache_(config.negative_cache_entries)
 {
     leveldb::Options options;
     options.create_if_missing = config_.create_if_not_exists;
@@ -68,38 +157,49 @@ SimpleDB::SimpleDB(const SimpleDBConfig& config)
         LOG(FATAL) << "Cannot create database. Error: " << status.ToString();
         throw runtime_error("Cannot create database. Error: " + status.ToString());
     }
-}
 
-void SimpleDB::connect()
-{
-    for (unsigned idx = 0; idx < config_.num_; idx++)
+    write_options_.sync = config_.sync_writes;
+
+    /* An id still named by a record is never handed out again, even if
+     * its file is gone: GC removes files before their records, and a
+     * leftover record would otherwise collect a new blob with that id */
+    uint64_t max_recorded_blob = 0;
     {
-        unsigned retry = 0;
-        conns_[idx] = new TCPSocket();
+        unique_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
+        for (it->Seek(GC_PREFIX); it->Valid() && it->key().starts_with(GC_PREFIX); it->Next())
+            max_recorded_blob = max(max_recorded_blob, gc_blob_id(it->key()));
+        for (const uint64_t blob_id : referenced_blobs(it.get()))
+            max_recorded_blob = max(max_recorded_blob, blob_id);
+    }
+
+    blobs_ = make_unique<BlobStore>(config_.db_ / "blobs", config_.sync_writes,
+                                    max_recorded_blob + 1);
+    if (config_.object_store_size > 0)
+        objects_ = make_unique<ContentStore>(config_.db_ / "objects", config_.object_store_size);
 
+    for (unsigned idx = 0; idx < config_.num_; idx++)
+    {
         if (idx == config_.replica_idx)
             continue;
 
-        while (retry < config_.conn_max_retry)
-        {
-            try
-            {
-                conns_[idx]->connect(config_.address_[idx]);
-                break;
-            }
-            catch (system_error& e)
-            {
-                LOG(ERROR) << "Failed to connect to replica " << idx << " " << e.what();
+        pools_[idx] = make_unique<ConnectionPool>(config_.address_[idx],
+                                            config_.max_idle_connections,
+                                            config_.conn_timeout_seconds,
+                                            config_.conn_max_retry);
+    }
 
-                if (retry == config_.conn_max_retry)
-                    rethrow_exception(current_exception());
-            }
-            retry++;
-            sleep(config_.conn_timeout_seconds);
-        }
+    maintenance_thread_ = thread(&SimpleDB::run_maintenance, this);
+}
+
+SimpleDB::~SimpleDB()
+{
+    {
+        const lock_guard<mutex> lguard(maintenance_lock_);
+        maintenance_stopping_ = true;
     }
 
-    init = true;
+    maintenance_wakeup_.notify_all();
+    maintenance_thread_.join();
 }
 
 void SimpleDB::get(vector<GetRequest>& download_requests,
@@ -107,14 +207,9 @@ void SimpleDB::get(vector<GetRequest>& download_requests,
                                     const DbOpStatus,
                                     const std::string&)>& callback)
 {
-    if (!init)
-        connect();
-
     const size_t bucket_count = config_.num_;
-    const size_t batch_size = config_.max_batch_size;
     vector<vector<GetRequest>> buckets(bucket_count);
 
-    // LOG(ERROR) << "GET Size=" << download_requests.size();
     for (size_t r_id = 0; r_id < download_requests.size(); r_id++)
     {
         const string& object_key = download_requests.at(r_id).object_key;
@@ -122,133 +217,207 @@ void SimpleDB::get(vector<GetRequest>& download_requests,
         buckets[bIdx].emplace_back(move(download_requests.at(r_id)));
     }
 
-    vector<size_t> non_empty_buckets;
-    for (size_t idx = 0; idx < bucket_count; idx++)
+    const uint64_t missing_epoch = put_epoch_.load();
+    const chrono::milliseconds remote_ttl(config_.remote_negative_ttl_ms);
+
+    /* Flights this call leads are completed as their results come in
+     * (or abandoned with an error if the callback throws); flights led
+     * by others are only waited on once all of ours are done. */
+    typedef SingleFlight<FetchResult>::Flight Flight;
+    SingleFlight<FetchResult>::Leader fetch_leader(fetches_, FetchResult());
+    SingleFlight<FetchResult>::Leader path_leader(materializations_, FetchResult());
+    vector<pair<const GetRequest*, shared_ptr<Flight>>> fetch_followers;
+    vector<pair<const GetRequest*, shared_ptr<Flight>>> path_followers;
+
+    /* Remote: serve cache hits directly and hand the misses to the async
+     * client, so that the network work overlaps with everything below. */
+    vector<vector<size_t>> misses(bucket_count);
+    vector<vector<pair<size_t, size_t>>> runs(bucket_count);
+
+    /* Sizes are not known up front, so runs are split by key count and
+     * a replica stops a response once past its byte budget; the keys it
+     * left out are asked for again, tagged from bucket_count on. Only
+     * appended to, so the references handed out stay valid. */
+    deque<pair<size_t, pair<size_t, size_t>>> rest;
+    RemoteClient::Batch batch;
+
+    for (size_t bIdx = 0; bIdx < bucket_count; bIdx++)
     {
-        if (buckets[idx].size() > 0)
-            non_empty_buckets.push_back(idx);
+        if (bIdx == config_.replica_idx || buckets[bIdx].empty())
+            continue;
+
+        for (size_t file_id = 0; file_id < buckets[bIdx].size(); file_id++)
+        {
+            auto &req = buckets[bIdx][file_id];
+
+            if (materialize_stored(req))
+            {
+                callback(req, DbOpStatus::STATUS_OK, string());
+                continue;
+            }
+
+            /* Check cache */
+            const auto content = immutable_object_cache_.access(req.object_key);
+            if (content)
+            {
+                materialize(req, *content, true);
+                callback(req, DbOpStatus::STATUS_OK, *content);
+
+                continue;
+            }
+
+            if (remote_ttl.count() > 0 && known_missing(req))
+            {
+                callback(req, DbOpStatus::STATUS_NOTFOUND, string());
+                continue;
+            }
+
+            shared_ptr<Flight> flight;
+            if (fetch_leader.join(req.object_key, flight))
+                misses[bIdx].push_back(file_id);
+            else
+                fetch_followers.emplace_back(&req, move(flight));
+        }
+
+        if (misses[bIdx].empty())
+            continue;
+
+        const auto& bucket = buckets[bIdx];
+        const auto& keys = misses[bIdx];
+        const auto& bucket_runs = runs[bIdx] = make_runs(keys.size(),
+                                            config_.multi_op_max_keys,
+                                            config_.multi_op_max_bytes);
+        remote_.submit(batch, bIdx, pools_[bIdx]->acquire(), bucket_runs.size(),
+            [&bucket, &keys, &bucket_runs](const size_t index, simpledb::proto::KVRequest& req)
+            {
+                auto get_req = req.mutable_multi_get_request();
+                for (size_t k = bucket_runs[index].first; k < bucket_runs[index].second; k++)
+                    get_req->add_keys(bucket[keys[k]].object_key);
+            }
+        );
     }
 
-    const size_t thread_count = non_empty_buckets.size();
-    vector<thread> threads;
-    for (size_t thread_index = 0;
-            thread_index < thread_count;
-            thread_index++)
+    /* Local: files that another get is already writing are waited on */
+    vector<GetRequest> local_requests;
+    for (const auto& req : buckets[config_.replica_idx])
     {
-        threads.emplace_back(
-            [&](const size_t index)
-            {
+        shared_ptr<Flight> flight;
+        if (not req.filename.initialized()
+            || path_leader.join(req.filename.get().string(), flight))
+        {
+            local_requests.push_back(req);
+        }
+        else
+        {
+            path_followers.emplace_back(&req, move(flight));
+        }
+    }
+
+    local_multi_get(local_requests,
+        [&](const GetRequest& req, const DbOpStatus status, const string& data)
+        {
+            if (req.filename.initialized())
+                path_leader.complete(req.filename.get().string(), {status, nullptr});
 
-                const size_t bIdx = non_empty_buckets[index];
-                // LOG(ERROR) << "tID=" << index << " bIdx=" << bIdx << " Replica= " << config_.replica_idx << " Size=" << buckets[bIdx].size();
-                TCPSocket conn;
-                conn.connect(config_.address_[bIdx]);
+            callback(req, status, data);
+        }
+    );
 
-                /* Local */
-                if (bIdx == config_.replica_idx)
-                {
-                    for (auto &req: buckets[bIdx])
-                    {
-                        string content;
-                        auto status = local_get(req, content);
-                        callback(req, status, content);
-                    }
-                }
-                else
+    while (batch.remaining() > 0)
+    {
+        auto completion = batch.next();
+        const bool resent = completion.tag >= bucket_count;
+        const size_t bIdx = resent ? rest.at(completion.tag - bucket_count).first
+                                    : completion.tag;
+        const auto run = resent ? rest.at(completion.tag - bucket_count).second
+                                    : runs[bIdx].at(completion.index);
+        auto &results = *completion.response.mutable_results();
+        const size_t served = results.size();
+        const bool ok = completion.ok && served > 0 && served <= run.second - run.first;
+
+        if (ok && run.first + served < run.second)
+        {
+            rest.emplace_back(bIdx, make_pair(run.first + served, run.second));
+            const auto &resend = rest.back().second;
+            const auto &bucket = buckets[bIdx];
+            const auto &keys = misses[bIdx];
+            remote_.submit(batch, bucket_count + rest.size() - 1, pools_[bIdx]->acquire(), 1,
+                [&bucket, &keys, &resend](const size_t, simpledb::proto::KVRequest& req)
                 {
-                    for (size_t first_file_idx = 0;
-                        first_file_idx < buckets[bIdx].size();
-                        first_file_idx += batch_size)
-                    {
-                        size_t expected_responses = 0;
-
-                        for (size_t file_id = first_file_idx;
-                            file_id < min(buckets[bIdx].size(), first_file_idx + batch_size);
-                            file_id += 1)
-                        {
-                            const string & object_key =
-                                buckets[bIdx].at(file_id).object_key;
-
-                            /* Check cache */
-                            string content;
-                            if (immutable_object_cache_.access(object_key, content))
-                            {
-                                LOG(ERROR) << "Cache Hit!";
-                                if (buckets[bIdx].at(file_id).filename.initialized())
-                                {
-                                    roost::atomic_create(content,
-                                        buckets[bIdx].at(file_id).filename.get(),
-                                        buckets[bIdx].at(file_id).mode.initialized(),
-                                        buckets[bIdx].at(file_id).mode.get_or(0));
-                                }
-
-                                callback(buckets[bIdx].at(file_id), DbOpStatus::STATUS_OK, content);
-
-                                continue;
-                            }
-
-                            LOG(ERROR) << "Cache Miss!";
-                            simpledb::proto::KVRequest req;
-                            req.set_id(file_id);
-                            auto get_req = req.mutable_get_request();
-                            get_req->set_key(object_key);
-
-                            // LOG(ERROR) << "GET " << object_key << " FROM " << bIdx;
-                            send_request(&conn, req);
-                            expected_responses++;
-                        }
-
-                        size_t response_count = 0;
-                        while (response_count != expected_responses)
-                        {
-                            simpledb::proto::KVResponse resp;
-
-                            if (!receive_response(&conn, resp))
-                                throw runtime_error("failed to get response");
-
-                            const size_t response_index = resp.id();
-                            auto &req = buckets[bIdx].at(response_index);
-                            string content;
-                            if (resp.return_code() != 0){
-                                callback(req, static_cast<DbOpStatus>(resp.return_code()), content);
-                                response_count++;
-                                continue;
-                            }
-
-                            // LOG(ERROR) << "GOT " << req.object_key << " FROM " << bIdx;
-                            content = std::move(resp.val());
-                            immutable_object_cache_.insert(req.object_key, content);
-                            if (req.filename.initialized())
-                            {
-                                roost::atomic_create(content, req.filename.get(),
-                                    req.mode.initialized(),
-                                    req.mode.get_or(0));
-                            }
-
-                            callback(req, DbOpStatus::STATUS_OK, content);
-
-                            response_count++;
-                        }
-                    }
+                    auto get_req = req.mutable_multi_get_request();
+                    for (size_t k = resend.first; k < resend.second; k++)
+                        get_req->add_keys(bucket[keys[k]].object_key);
                 }
-            },
-            thread_index
-        );
+            );
+        }
+
+        const size_t end = ok ? run.first + served : run.second;
+        for (size_t k = run.first; k < end; k++)
+        {
+            auto &req = buckets[bIdx].at(misses[bIdx][k]);
+
+            if (not ok)
+            {
+                fetch_leader.complete(req.object_key, {DbOpStatus::STATUS_IOERROR, nullptr});
+                callback(req, DbOpStatus::STATUS_IOERROR, string());
+                continue;
+            }
+
+            auto &result = results[k - run.first];
+            if (result.return_code() != 0)
+            {
+                const auto status = static_cast<DbOpStatus>(result.return_code());
+                if (status == DbOpStatus::STATUS_NOTFOUND && remote_ttl.count() > 0)
+                    note_missing(req.object_key, false, missing_epoch, remote_ttl);
+                fetch_leader.complete(req.object_key, {status, nullptr});
+                callback(req, status, string());
+                continue;
+            }
+
+            /* Only what the owner reports immutable can be kept: nothing
+             * would tell this replica when a mutable object changes */
+            const auto content = make_shared<const string>(move(*result.mutable_val()));
+            if (result.immutable())
+                immutable_object_cache_.insert(req.object_key, content);
+            materialize(req, *content, result.immutable());
+
+            fetch_leader.complete(req.object_key,
+                                {DbOpStatus::STATUS_OK, content, result.immutable()});
+            callback(req, DbOpStatus::STATUS_OK, *content);
+        }
+    }
+
+    for (const auto& follower : fetch_followers)
+    {
+        const GetRequest& req = *follower.first;
+        const FetchResult& result = follower.second->wait();
+        if (result.status != DbOpStatus::STATUS_OK || not result.content)
+        {
+            callback(req, result.status, string());
+            continue;
+        }
+
+        if (req.filename.initialized() && not roost::exists(req.filename.get())
+            && not materialize_stored(req))
+        {
+            materialize(req, *result.content, result.immutable);
+        }
+
+        callback(req, DbOpStatus::STATUS_OK, *result.content);
     }
 
-    for (auto & thread : threads)
-        thread.join();
+    for (const auto& follower : path_followers)
+    {
+        const FetchResult& result = follower.second->wait();
+        callback(*follower.first, result.status, string());
+    }
 }
 
 void SimpleDB::put(vector<PutRequest>& upload_requests,
             const function<void(const PutRequest&,
                                     const DbOpStatus)>& callback)
 {
-    if (!init)
-        connect();
-
     const size_t bucket_count = config_.num_;
-    const size_t batch_size = config_.max_batch_size;
     vector<vector<PutRequest>> buckets(bucket_count);
 
     for (size_t r_id = 0; r_id < upload_requests.size(); r_id++)
@@ -258,112 +427,158 @@ void SimpleDB::put(vector<PutRequest>& upload_requests,
         buckets[bIdx].emplace_back(move(upload_requests.at(r_id)));
     }
 
-    vector<size_t> non_empty_buckets;
-    for (size_t idx = 0; idx < bucket_count; idx++)
-    {
-        if (buckets[idx].size() > 0)
-            non_empty_buckets.push_back(idx);
-    }
+    vector<vector<pair<size_t, size_t>>> runs(bucket_count);
+    RemoteClient::Batch batch;
 
-    const size_t thread_count = non_empty_buckets.size();
-    vector<thread> threads;
-    for (size_t thread_index = 0;
-            thread_index < thread_count;
-            thread_index++)
+    for (size_t bIdx = 0; bIdx < bucket_count; bIdx++)
     {
-        threads.emplace_back(
-            [&](const size_t index)
-            {
-                const size_t bIdx = non_empty_buckets[index];
-                TCPSocket conn;
-                conn.connect(config_.address_[bIdx]);
+        if (bIdx == config_.replica_idx || buckets[bIdx].empty())
+            continue;
 
-                /* Local */
-                if (bIdx == config_.replica_idx)
-                {
-                    for (auto &req: buckets[bIdx])
-                    {
-                        auto status = local_put(req);
-                        callback(req, status);
-                    }
-                }
-                else
+        /* Only immutable fetched objects are stored, but a store left by
+         * an older build may hold mutable ones; those have to go */
+        for (auto &req: buckets[bIdx])
+        {
+            if (!req.immutable)
+                forget_stored(req.object_key);
+        }
+
+        /* Values are only materialized (and files only read) by the
+         * client engine when the request is about to go on the wire. */
+        const auto& bucket = buckets[bIdx];
+        const auto& bucket_runs = runs[bIdx] = make_runs(bucket.size(),
+            config_.multi_op_max_keys, config_.multi_op_max_bytes,
+            [&bucket](const size_t idx) -> size_t
+            {
+                return bucket[idx].object_data.initialized()
+                        ? bucket[idx].object_data.get().length()
+                        : roost::file_size(bucket[idx].filename.get());
+            }
+        );
+        remote_.submit(batch, bIdx, pools_[bIdx]->acquire(), bucket_runs.size(),
+            [this, &bucket, &bucket_runs](const size_t index, simpledb::proto::KVRequest& req)
+            {
+                auto multi_req = req.mutable_multi_put_request();
+                for (size_t k = bucket_runs[index].first; k < bucket_runs[index].second; k++)
                 {
-                    for (size_t first_file_idx = 0;
-                        first_file_idx < buckets[bIdx].size();
-                        first_file_idx += batch_size)
+                    auto &request = bucket[k];
+                    auto put_req = multi_req->add_requests();
+                    put_req->set_key(request.object_key);
+                    if (request.object_data.initialized())
+                        put_req->set_val(request.object_data.get());
+                    else
+                        put_req->set_val(read_object_file(request.filename.get()));
+                    put_req->set_immutable(request.immutable);
+                    put_req->set_executable(request.executable);
+
+                    if (request.immutable)
                     {
-                        size_t expected_responses = 0;
-
-                        for (size_t file_id = first_file_idx;
-                            file_id < min(buckets[bIdx].size(), first_file_idx + batch_size);
-                            file_id += 1)
-                        {
-                            string content;
-                            auto &request = buckets[bIdx].at(file_id);
-                            if (not request.object_data.initialized())
-                            {
-                                FileDescriptor file {
-                                    CheckSystemCall("open " + request.filename.get().string(),
-                                        open(request.filename.get().string().c_str(), O_RDONLY))
-                                };
-                                while (not file.eof())
-                                    { content.append(file.read()); }
-                                file.close();
-                            }
-
-                            simpledb::proto::KVRequest req;
-                            req.set_id(file_id);
-                            auto put_req = req.mutable_put_request();
-                            put_req->set_key(request.object_key);
-                            put_req->set_val(request.object_data.get_or(content));
-                            put_req->set_immutable(request.immutable);
-                            put_req->set_executable(request.executable);
-
-                            send_request(&conn, req);
-                            if (request.immutable)
-                            {
-                                immutable_object_cache_.insert(request.object_key, request.object_data.get_or(content));
-                            }
-                            expected_responses++;
-                        }
-
-                        size_t response_count = 0;
-                        while (response_count != expected_responses)
-                        {
-                            simpledb::proto::KVResponse resp;
-
-                            if (!receive_response(&conn, resp))
-                                throw runtime_error("failed to get response");
-
-                            const size_t response_index = resp.id();
-                            auto &req = buckets[bIdx].at(response_index);
-
-                            if (DbOpStatus::STATUS_OK != static_cast<DbOpStatus>(resp.return_code()))
-                            {
-                                immutable_object_cache_.drop(req.object_key);
-                            }
-                            callback(req, static_cast<DbOpStatus>(resp.return_code()));
-
-                            response_count++;
-                        }
+                        immutable_object_cache_.insert(request.object_key,
+                                        make_shared<const string>(put_req->val()));
                     }
                 }
-            }, thread_index
+            }
+        );
+    }
+
+    /* Local */
+    local_multi_put(buckets[config_.replica_idx], callback);
+
+    while (batch.remaining() > 0)
+    {
+        auto completion = batch.next();
+        const auto &run = runs[completion.tag].at(completion.index);
+        const auto &results = completion.response.results();
+        const bool ok = completion.ok &&
+                    results.size() == static_cast<int>(run.second - run.first);
+
+        for (size_t k = run.first; k < run.second; k++)
+        {
+            auto &req = buckets[completion.tag].at(k);
+            auto status = ok
+                        ? static_cast<DbOpStatus>(results[k - run.first].return_code())
+                        : DbOpStatus::STATUS_IOERROR;
+
+            if (DbOpStatus::STATUS_OK != status)
+            {
+                immutable_object_cache_.drop(req.object_key);
+            }
+            forget_missing(req.object_key);
+            callback(req, status);
+        }
+    }
+}
+
+void SimpleDB::stat(const vector<string>& object_keys,
+    const function<void(const string&,
+                            const DbOpStatus,
+                            const simpledb::proto::ObjectMetadata&)>& callback)
+{
+    const size_t bucket_count = config_.num_;
+
+    vector<vector<string>> buckets(bucket_count);
+    for (const auto& object_key : object_keys)
+        buckets[crc16(object_key) % bucket_count].push_back(object_key);
+
+    vector<vector<pair<size_t, size_t>>> runs(bucket_count);
+    RemoteClient::Batch batch;
+
+    for (size_t bIdx = 0; bIdx < bucket_count; bIdx++)
+    {
+        if (bIdx == config_.replica_idx || buckets[bIdx].empty())
+            continue;
+
+        const auto& bucket = buckets[bIdx];
+        const auto& bucket_runs = runs[bIdx] = make_runs(bucket.size(),
+                                            config_.multi_op_max_keys,
+                                            config_.multi_op_max_bytes);
+        remote_.submit(batch, bIdx, pools_[bIdx]->acquire(), bucket_runs.size(),
+            [&bucket, &bucket_runs](const size_t index, simpledb::proto::KVRequest& req)
+            {
+                auto stat_req = req.mutable_multi_stat_request();
+                for (size_t k = bucket_runs[index].first; k < bucket_runs[index].second; k++)
+                    stat_req->add_keys(bucket[k]);
+            }
         );
     }
 
-    for (auto & thread : threads)
-        thread.join();
+    /* Local */
+    for (const auto& object_key : buckets[config_.replica_idx])
+    {
+        simpledb::proto::ObjectMetadata metadata;
+        const auto status = local_stat(object_key, metadata);
+        metadata.clear_blob_id();
+        callback(object_key, status, metadata);
+    }
+
+    while (batch.remaining() > 0)
+    {
+        auto completion = batch.next();
+        const auto &run = runs[completion.tag].at(completion.index);
+        const auto &results = completion.response.results();
+        const bool ok = completion.ok &&
+                    results.size() == static_cast<int>(run.second - run.first);
+
+        for (size_t k = run.first; k < run.second; k++)
+        {
+            if (not ok)
+            {
+                callback(buckets[completion.tag].at(k), DbOpStatus::STATUS_IOERROR,
+                        simpledb::proto::ObjectMetadata());
+                continue;
+            }
+
+            const auto &result = results[k - run.first];
+            callback(buckets[completion.tag].at(k),
+                    static_cast<DbOpStatus>(result.return_code()), result.metadata());
+        }
+    }
 }
 
 void SimpleDB::del(const vector<string>& object_keys,
     const function<void(const string&,
                             const DbOpStatus)>& callback)
 {
-    if (!init)
-        connect();
-
     const size_t bucket_count = config_.num_;
 
     vector<vector<string>> buckets(bucket_count);
@@ -374,55 +589,91 @@ void SimpleDB::del(const vector<string>& object_keys,
         buckets[bIdx].push_back(object_key);
     }
 
+    vector<vector<pair<size_t, size_t>>> runs(bucket_count);
+    RemoteClient::Batch batch;
+
     for (size_t bIdx = 0; bIdx < bucket_count; bIdx++)
     {
-        if (bIdx == config_.replica_idx)
+        if (bIdx == config_.replica_idx || buckets[bIdx].empty())
+            continue;
+
+        for (auto &req: buckets[bIdx])
         {
-            /* Local */
-            for (auto &req: buckets[bIdx])
-            {
-                auto status = local_del(req);
-                callback(req, status);
-            }
+            immutable_object_cache_.drop(req);
+            forget_stored(req);
         }
-        else
-        {
-            size_t expected_responses = 0;
-            for (auto & req: buckets[bIdx])
+
+        const auto& bucket = buckets[bIdx];
+        const auto& bucket_runs = runs[bIdx] = make_runs(bucket.size(),
+                                            config_.multi_op_max_keys,
+                                            config_.multi_op_max_bytes);
+        remote_.submit(batch, bIdx, pools_[bIdx]->acquire(), bucket_runs.size(),
+            [&bucket, &bucket_runs](const size_t index, simpledb::proto::KVRequest& req)
             {
-                simpledb::proto::KVRequest request;
-                request.set_id(expected_responses++);
-                auto del_req = request.mutable_delete_request();
-                del_req->set_key(req);
+                auto del_req = req.mutable_multi_delete_request();
+                for (size_t k = bucket_runs[index].first; k < bucket_runs[index].second; k++)
+                    del_req->add_keys(bucket[k]);
+            }
+        );
+    }
 
-                send_request(this->conns_[bIdx], request);
-                immutable_object_cache_.drop(req);
+    /* Local */
+    local_multi_del(buckets[config_.replica_idx], callback);
 
-                simpledb::proto::KVResponse resp;
+    while (batch.remaining() > 0)
+    {
+        auto completion = batch.next();
+        const auto &run = runs[completion.tag].at(completion.index);
+        const auto &results = completion.response.results();
+        const bool ok = completion.ok &&
+                    results.size() == static_cast<int>(run.second - run.first);
 
-                if (!receive_response(this->conns_[bIdx], resp))
-                    throw runtime_error("failed to get response");
+        for (size_t k = run.first; k < run.second; k++)
+        {
+            auto status = ok
+                        ? static_cast<DbOpStatus>(results[k - run.first].return_code())
+                        : DbOpStatus::STATUS_IOERROR;
 
-                callback(req, static_cast<DbOpStatus>(resp.return_code()));
-            }
+            callback(buckets[completion.tag].at(k), status);
         }
     }
 }
 
-DbOpStatus SimpleDB::local_get(const GetRequest& request, std::string& data)
+DbOpStatus SimpleDB::stat_object(const leveldb::ReadOptions& options,
+                                const std::string& object_key,
+                                simpledb::proto::ObjectMetadata& metadata,
+                                simpledb::proto::FileMetadata* legacy)
 {
     std::string val;
-    leveldb::Status s = db->Get(leveldb::ReadOptions(), request.object_key, &val);
+    leveldb::Status s = db->Get(options, metadata_key(object_key), &val);
+
+    if (s.ok())
+    {
+        if (!metadata.ParseFromString(val))
+        {
+            LOG(ERROR) << "Stat Key=" << object_key << " Error: Protobuf Parse error";
+            return DbOpStatus::STATUS_IOERROR;
+        }
 
+        return DbOpStatus::STATUS_OK;
+    }
+    else if (!s.IsNotFound())
+    {
+        LOG(INFO) << "Stat Key=" << object_key << " Error: " << s.ToString();
+        return DbOpStatus::STATUS_IOERROR;
+    }
+
+    /* Not migrated yet: fall back to the single-record layout */
+    s = db->Get(options, object_key, &val);
     if (!s.ok())
     {
         if (s.IsNotFound())
         {
-            LOG(INFO) << "Get Key=" << request.object_key << " Not found";
+            LOG(INFO) << "Stat Key=" << object_key << " Not found";
             return DbOpStatus::STATUS_NOTFOUND;
         }
 
-        LOG(INFO) << "Get Key=" << request.object_key << " Error: " << s.ToString();
+        LOG(INFO) << "Stat Key=" << object_key << " Error: " << s.ToString();
         return DbOpStatus::STATUS_IOERROR;
     }
 
@@ -431,88 +682,935 @@ DbOpStatus SimpleDB::local_get(const GetRequest& request, std::string& data)
     istream.SetTotalBytesLimit(INT_MAX, INT_MAX);
     if (!file.ParseFromCodedStream(&istream))
     {
-        LOG(ERROR) << "Get Key=" << request.object_key << " Error: Protobuf Parse error";
+        LOG(ERROR) << "Stat Key=" << object_key << " Error: Protobuf Parse error";
         return DbOpStatus::STATUS_IOERROR;
     }
 
-    if (request.exec && !file.executable())
-        return DbOpStatus::STATUS_NOTFOUND;
-
-    data = std::move(file.content());
+    metadata.set_immutable(file.immutable());
+    metadata.set_executable(file.executable());
+    metadata.set_size(file.content().length());
+    metadata.set_checksum(crc32c(file.content()));
+    metadata.set_version(0);
 
-    if (request.filename.initialized())
-    {
-        roost::atomic_create(data, request.filename.get(),
-            request.mode.initialized(),
-            request.mode.get_or(0));
-    }
+    if (legacy != nullptr)
+        legacy->Swap(&file);
 
     return DbOpStatus::STATUS_OK;
 }
 
-DbOpStatus SimpleDB::local_put(const PutRequest& request)
+DbOpStatus SimpleDB::read_object(const leveldb::ReadOptions& options,
+                                const uint64_t epoch,
+                                const GetRequest& request, std::string& data,
+                                bool* immutable)
 {
-    std::string val;
-    simpledb::proto::FileMetadata file;
+    simpledb::proto::ObjectMetadata metadata;
+    simpledb::proto::FileMetadata legacy;
+
+    DbOpStatus status = stat_object(options, request.object_key, metadata, &legacy);
+    if (status != DbOpStatus::STATUS_OK)
+        return status;
+
+    if (request.exec && !metadata.executable())
+        return DbOpStatus::STATUS_NOTFOUND;
 
-    leveldb::Status s = db->Get(leveldb::ReadOptions(), request.object_key, &val);
-    if (!s.IsNotFound())
+    if (immutable != nullptr)
+        *immutable = metadata.immutable();
+
+    if (metadata.blob_id() == 0 && metadata.immutable() && materialize_stored(request))
+    {
+        data.clear();
+        return DbOpStatus::STATUS_OK;
+    }
+
+    if (metadata.blob_id() != 0)
     {
-        google::protobuf::io::CodedInputStream istream((const uint8_t*) val.c_str(), val.length());
-        istream.SetTotalBytesLimit(INT_MAX, INT_MAX);
-        if (!file.ParseFromCodedStream(&istream))
+        /* Straight from file to file when the caller wants a file. Only
+         * immutable blobs are hard linked: the link outlives the object. */
+        try
         {
-            LOG(ERROR) << "Set Key=" << request.object_key << " Error: Protobuf Parse error";
-            return DbOpStatus::STATUS_IOERROR;
+            if (request.filename.initialized())
+            {
+                blobs_->materialize(metadata.blob_id(), request.filename.get(),
+                    request.mode.initialized(), request.mode.get_or(0),
+                    metadata.immutable());
+                data.clear();
+            }
+            else
+            {
+                data = blobs_->read(metadata.blob_id());
+            }
         }
-
-        if (file.immutable())
+        catch (const exception& e)
         {
-            LOG(INFO) << "Set Key=" << request.object_key << " Error: Cannot modify immutable file";
-            return DbOpStatus::STATUS_IMMUTABLE;
+            LOG(ERROR) << "Get Key=" << request.object_key << " Error: " << e.what();
+            return DbOpStatus::STATUS_IOERROR;
         }
+
+        return DbOpStatus::STATUS_OK;
     }
 
-    val.clear();
-    if (not request.object_data.initialized())
+    /* Legacy records carry the content inline and have no version */
+    if (metadata.version() == 0)
     {
-        FileDescriptor file {
-            CheckSystemCall("open " + request.filename.get().string(),
-                open(request.filename.get().string().c_str(), O_RDONLY))
-        };
-        while (not file.eof())
-            { val.append(file.read()); }
-        file.close();
+        data.swap(*legacy.mutable_content());
     }
-
-    file.set_content(request.object_data.get_or(val));
-    file.set_immutable(request.immutable);
-    file.set_executable(request.executable);
-    val = file.SerializeAsString();
-
-    s = db->Put(leveldb::WriteOptions(), request.object_key, val);
-    if (!s.ok())
+    else
     {
-        LOG(ERROR) << "Set Key=" << request.object_key << " Error: " << s.ToString();
-        return DbOpStatus::STATUS_IOERROR;
+        leveldb::Status s = db->Get(options, content_key(request.object_key), &data);
+        if (!s.ok())
+        {
+            LOG(ERROR) << "Get Key=" << request.object_key << " Error: Content missing " << s.ToString();
+            return DbOpStatus::STATUS_IOERROR;
+        }
     }
 
+    if (metadata.immutable())
+        fill_local_cache(request.object_key, make_shared<const string>(data), epoch);
+
+    materialize(request, data, metadata.immutable());
     return DbOpStatus::STATUS_OK;
 }
 
-DbOpStatus SimpleDB::local_del(const std::string& key)
+DbOpStatus SimpleDB::read_object_into(const leveldb::ReadOptions& options,
+                                    const uint64_t epoch,
+                                    const GetRequest& request,
+                                    const ContentAllocator& allocate)
 {
-    leveldb::Status s = db->Delete(leveldb::WriteOptions(), key);
-    if (s.IsNotFound())
+    if (request.filename.initialized())
     {
-        LOG(INFO) << "Remove Key=" << key << " Error: " << s.ToString();
+        std::string data;
+        bool immutable = false;
+        DbOpStatus status = read_object(options, epoch, request, data, &immutable);
+        if (status == DbOpStatus::STATUS_OK)
+            memcpy(allocate(request, data.length(), immutable), data.data(), data.length());
+        return status;
+    }
+
+    simpledb::proto::ObjectMetadata metadata;
+    simpledb::proto::FileMetadata legacy;
+
+    DbOpStatus status = stat_object(options, request.object_key, metadata, &legacy);
+    if (status != DbOpStatus::STATUS_OK)
+        return status;
+
+    if (request.exec && !metadata.executable())
         return DbOpStatus::STATUS_NOTFOUND;
+
+    return read_content_into(options, epoch, request, metadata, legacy, allocate);
+}
+
+DbOpStatus SimpleDB::read_content_into(const leveldb::ReadOptions& options,
+                                    const uint64_t epoch,
+                                    const GetRequest& request,
+                                    const simpledb::proto::ObjectMetadata& metadata,
+                                    const simpledb::proto::FileMetadata& legacy,
+                                    const ContentAllocator& allocate)
+{
+    if (metadata.blob_id() != 0)
+    {
+        try
+        {
+            blobs_->read_into(metadata.blob_id(),
+                            allocate(request, metadata.size(), metadata.immutable()),
+                            metadata.size());
+        }
+        catch (const exception& e)
+        {
+            LOG(ERROR) << "Get Key=" << request.object_key << " Error: " << e.what();
+            return DbOpStatus::STATUS_IOERROR;
+        }
+
+        return DbOpStatus::STATUS_OK;
     }
-    else if (!s.ok())
+
+    if (metadata.version() == 0)
     {
-        LOG(ERROR) << "Remove Key=" << key << " Error: " << s.ToString();
+        const std::string& content = legacy.content();
+        memcpy(allocate(request, content.length(), metadata.immutable()),
+                content.data(), content.length());
+        return DbOpStatus::STATUS_OK;
+    }
+
+    /* DB::Get would copy the value into a string first; an iterator
+     * exposes it in place, inside the memtable or the table block. */
+    const string key = content_key(request.object_key);
+    unique_ptr<leveldb::Iterator> it(db->NewIterator(options));
+    it->Seek(key);
+    if (!it->Valid() || it->key() != leveldb::Slice(key))
+    {
+        LOG(ERROR) << "Get Key=" << request.object_key << " Error: Content missing "
+                << it->status().ToString();
         return DbOpStatus::STATUS_IOERROR;
     }
 
+    const leveldb::Slice value = it->value();
+    if (metadata.immutable() && local_object_cache_.capacity() > 0)
+    {
+        /* Filling costs a second copy, but only on the first read */
+        auto content = make_shared<const string>(value.data(), value.size());
+        memcpy(allocate(request, content->length(), true), content->data(), content->length());
+        fill_local_cache(request.object_key, move(content), epoch);
+        return DbOpStatus::STATUS_OK;
+    }
+
+    memcpy(allocate(request, value.size(), metadata.immutable()), value.data(), value.size());
+    return DbOpStatus::STATUS_OK;
+}
+
+DbOpStatus SimpleDB::prepare_put(const PutRequest& request, leveldb::WriteBatch& batch,
+                                vector<uint64_t>& new_blobs)
+{
+    simpledb::proto::ObjectMetadata metadata;
+    bool legacy = false;
+    uint64_t old_blob = 0;
+
+    DbOpStatus status = stat_object(leveldb::ReadOptions(), request.object_key, metadata);
+    if (status == DbOpStatus::STATUS_OK)
+    {
+        if (metadata.immutable())
+        {
+            LOG(INFO) << "Set Key=" << request.object_key << " Error: Cannot modify immutable file";
+            return DbOpStatus::STATUS_IMMUTABLE;
+        }
+
+        legacy = (metadata.version() == 0);
+        old_blob = metadata.blob_id();
+    }
+    else if (status != DbOpStatus::STATUS_NOTFOUND)
+    {
+        return status;
+    }
+
+    const uint64_t version = metadata.version() + 1;
+    metadata.Clear();
+    metadata.set_immutable(request.immutable);
+    metadata.set_executable(request.executable);
+    metadata.set_version(version);
+
+    const uint64_t size = request.object_data.initialized()
+                        ? request.object_data.get().length()
+                        : roost::file_size(request.filename.get());
+
+    if (config_.blob_min_size > 0 && size >= config_.blob_min_size)
+    {
+        /* Read-only, with the modes the exec cache asks for, so that
+         * materializing an immutable blob can be a plain hard link */
+        const mode_t mode = request.executable ? 0544 : 0444;
+        uint64_t blob_size;
+        uint32_t checksum;
+        uint64_t blob_id;
+
+        try
+        {
+            if (request.object_data.initialized())
+            {
+                blob_id = blobs_->write(request.object_data.get(), mode);
+                blob_size = request.object_data.get().length();
+                checksum = crc32c(request.object_data.get());
+            }
+            else
+            {
+                blob_id = blobs_->import(request.filename.get(), mode, blob_size, checksum);
+            }
+        }
+        catch (const exception& e)
+        {
+            LOG(ERROR) << "Set Key=" << request.object_key << " Error: " << e.what();
+            return DbOpStatus::STATUS_IOERROR;
+        }
+
+        new_blobs.push_back(blob_id);
+        metadata.set_size(blob_size);
+        metadata.set_checksum(checksum);
+        metadata.set_blob_id(blob_id);
+
+        batch.Put(metadata_key(request.object_key), metadata.SerializeAsString());
+        batch.Delete(content_key(request.object_key));
+    }
+    else
+    {
+        std::string content;
+        if (not request.object_data.initialized())
+        {
+            content = read_object_file(request.filename.get());
+        }
+        const std::string& data = request.object_data.get_or(content);
+
+        metadata.set_size(data.length());
+        metadata.set_checksum(crc32c(data));
+
+        batch.Put(metadata_key(request.object_key), metadata.SerializeAsString());
+        batch.Put(content_key(request.object_key), data);
+    }
+
+    if (legacy)
+        batch.Delete(request.object_key);
+    if (old_blob != 0)
+        batch.Put(gc_key(old_blob), now_seconds());
+
     return DbOpStatus::STATUS_OK;
-}
\ No newline at end of file
+}
+
+void SimpleDB::remove_object(const std::string& object_key, leveldb::WriteBatch& batch)
+{
+    simpledb::proto::ObjectMetadata metadata;
+    if (stat_object(leveldb::ReadOptions(), object_key, metadata) == DbOpStatus::STATUS_OK
+            && metadata.blob_id() != 0)
+    {
+        batch.Put(gc_key(metadata.blob_id()), now_seconds());
+    }
+
+    batch.Delete(metadata_key(object_key));
+    batch.Delete(content_key(object_key));
+    batch.Delete(object_key);
+}
+
+void SimpleDB::materialize(const GetRequest& request, const std::string& data,
+                            const bool immutable)
+{
+    if (!request.filename.initialized())
+        return;
+
+    roost::atomic_create(data, request.filename.get(),
+        request.mode.initialized(),
+        request.mode.get_or(0));
+
+    if (immutable && objects_)
+        objects_->adopt(request.object_key, request.filename.get());
+}
+
+bool SimpleDB::materialize_stored(const GetRequest& request)
+{
+    return objects_ && request.filename.initialized()
+        && objects_->materialize(request.object_key, request.filename.get(),
+                                request.mode.initialized(), request.mode.get_or(0));
+}
+
+void SimpleDB::forget_stored(const string& object_key)
+{
+    if (objects_)
+        objects_->remove(object_key);
+}
+
+Cache::Value SimpleDB::cached_content(const GetRequest& request)
+{
+    /* Entries do not record the exec flag, exec reads go to LevelDB */
+    if (local_object_cache_.capacity() == 0 || request.exec)
+        return nullptr;
+
+    return local_object_cache_.access(request.object_key);
+}
+
+bool SimpleDB::serve_cached(const GetRequest& request, std::string& data)
+{
+    const auto cached = cached_content(request);
+    if (!cached)
+        return false;
+
+    data = *cached;
+    if (!materialize_stored(request))
+        materialize(request, data, true);
+    return true;
+}
+
+bool SimpleDB::serve_cached(const GetRequest& request, const ContentAllocator& allocate)
+{
+    /* Hot immutable objects: no snapshot, no LevelDB lookup, no protobuf */
+    const auto cached = cached_content(request);
+    if (!cached)
+        return false;
+
+    serve_cached(request, cached, allocate);
+    return true;
+}
+
+void SimpleDB::serve_cached(const GetRequest& request, const Cache::Value& cached,
+                            const ContentAllocator& allocate)
+{
+    if (!materialize_stored(request))
+        materialize(request, *cached, true);
+    memcpy(allocate(request, cached->length(), true), cached->data(), cached->length());
+}
+
+void SimpleDB::fill_local_cache(const string& object_key, Cache::Value content,
+                                const uint64_t epoch)
+{
+    if (local_object_cache_.capacity() == 0)
+        return;
+
+    /* `epoch` was read before the data was. If a delete committed since,
+     * it may have invalidated the key before this insert; undo it. A
+     * delete that bumps the epoch after this check drops it itself. */
+    local_object_cache_.insert(object_key, move(content));
+    if (delete_epoch_.load() != epoch)
+        local_object_cache_.drop(object_key);
+}
+
+void SimpleDB::fill_local_cache(const PutRequest& request, const uint64_t epoch)
+{
+    /* Blobs are served from the page cache and are not duplicated here */
+    if (!request.immutable || !request.object_data.initialized() ||
+        (config_.blob_min_size > 0 && request.object_data.get().length() >= config_.blob_min_size))
+        return;
+
+    fill_local_cache(request.object_key,
+                    make_shared<const string>(request.object_data.get()), epoch);
+}
+
+void SimpleDB::invalidate_local_cache(const vector<string>& object_keys)
+{
+    delete_epoch_++;
+    for (const auto& key : object_keys)
+    {
+        local_object_cache_.drop(key);
+        forget_stored(key);
+    }
+}
+
+bool SimpleDB::known_missing(const GetRequest& request)
+{
+    return negative_cache_.contains(request.object_key, request.exec);
+}
+
+void SimpleDB::note_missing(const string& object_key, const bool exec_only,
+                            const uint64_t epoch, const chrono::milliseconds ttl)
+{
+    /* An exec lookup cannot tell an absent key from one that is not
+     * executable, so it only vouches for exec lookups. As with deletes
+     * and the local cache, a put that may have been missed by the lookup
+     * undoes the insert. */
+    negative_cache_.insert(object_key, exec_only, ttl);
+    if (put_epoch_.load() != epoch)
+        negative_cache_.drop(object_key);
+}
+
+void SimpleDB::forget_missing(const string& object_key)
+{
+    put_epoch_++;
+    negative_cache_.drop(object_key);
+}
+
+void SimpleDB::discard_blobs(const vector<uint64_t>& blob_ids)
+{
+    /* Written for a batch that was never applied, so nothing refers to them */
+    for (const uint64_t blob_id : blob_ids)
+        blobs_->remove(blob_id);
+}
+
+void SimpleDB::collect_garbage(const bool sweep_preexisting)
+{
+    leveldb::ReadOptions options;
+    options.snapshot = db->GetSnapshot();
+    unique_ptr<leveldb::Iterator> it(db->NewIterator(options));
+
+    /* A reader may have looked up a pointer just before it was dropped,
+     * so a dead blob is given one full interval before it goes away. */
+    const uint64_t now = strtoull(now_seconds().c_str(), nullptr, 10);
+    leveldb::WriteBatch batch;
+    vector<uint64_t> collected;
+    size_t dropped = 0;     /* records, including stale ones */
+    unordered_set<uint64_t> pending;
+
+    for (it->Seek(GC_PREFIX); it->Valid() && it->key().starts_with(GC_PREFIX); it->Next())
+    {
+        const string key = it->key().ToString();
+        const uint64_t blob_id = gc_blob_id(it->key());
+        const uint64_t died = strtoull(it->value().ToString().c_str(), nullptr, 10);
+
+        pending.insert(blob_id);
+        if (now < died + config_.blob_gc_interval_seconds)
+            continue;
+
+        collected.push_back(blob_id);
+        batch.Delete(key);
+        dropped++;
+    }
+
+    unordered_set<uint64_t> live;
+    if (sweep_preexisting || !collected.empty())
+        live = referenced_blobs(it.get());
+
+    /* A record for a blob that metadata still points to is stale: only
+     * the record goes */
+    const auto stale = remove_if(collected.begin(), collected.end(),
+        [&live](const uint64_t blob_id) { return live.count(blob_id) > 0; });
+    for (auto stale_it = stale; stale_it != collected.end(); stale_it++)
+        LOG(ERROR) << "Blob GC skipped referenced blob " << *stale_it;
+    collected.erase(stale, collected.end());
+
+    /* Blobs of puts whose batch never made it to the log because the
+     * process died in between. Only blobs from before this run can be
+     * judged: newer ones may belong to a batch still being committed. */
+    size_t orphans = 0;
+    if (sweep_preexisting)
+    {
+        for (const uint64_t blob_id : blobs_->list_preexisting())
+        {
+            if (live.count(blob_id) == 0 && pending.count(blob_id) == 0)
+            {
+                blobs_->remove(blob_id);
+                orphans++;
+            }
+        }
+    }
+
+    it.reset();
+    db->ReleaseSnapshot(options.snapshot);
+
+    /* Files first: if we die before the records go, they are retried */
+    for (const uint64_t blob_id : collected)
+        blobs_->remove(blob_id);
+
+    if (dropped > 0)
+    {
+        leveldb::Status s = db->Write(write_options_, &batch);
+        if (!s.ok())
+            LOG(ERROR) << "Blob GC Error: " << s.ToString();
+    }
+
+    if (!collected.empty() || orphans > 0)
+        LOG(INFO) << "Blob GC removed " << collected.size() << " dead and "
+                << orphans << " orphaned blobs";
+}
+
+static void log_cache_stats(const string& name, const Cache::Stats& stats)
+{
+    const uint64_t lookups = stats.hits + stats.misses;
+    if (lookups == 0)
+        return;
+
+    LOG(INFO) << name << " cache: hit rate " << (100 * stats.hits / lookups) << "% ("
+            << stats.hits << "/" << lookups << "), "
+            << stats.resident_bytes << "/" << stats.capacity << " bytes in "
+            << stats.entries << " entries, " << stats.evictions << " evictions";
+}
+
+static void log_negative_cache_stats(const NegativeCache::Stats& stats)
+{
+    const uint64_t lookups = stats.hits + stats.misses;
+    if (lookups == 0)
+        return;
+
+    LOG(INFO) << "Negative cache: hit rate " << (100 * stats.hits / lookups) << "% ("
+            << stats.hits << "/" << lookups << "), "
+            << stats.entries << "/" << stats.capacity << " entries, "
+            << stats.invalidations << " invalidations, "
+            << stats.expirations << " expirations, " << stats.evictions << " evictions";
+}
+
+void SimpleDB::run_maintenance()
+{
+    bool first = true;
+    unique_lock<mutex> ulock(maintenance_lock_);
+
+    while (!maintenance_stopping_)
+    {
+        ulock.unlock();
+        try
+        {
+            collect_garbage(first);
+            first = false;
+        }
+        catch (const exception& e)
+        {
+            LOG(ERROR) << "Blob GC failed: " << e.what();
+        }
+
+        log_cache_stats("Local object", local_object_cache_.stats());
+        log_cache_stats("Immutable object", immutable_object_cache_.stats());
+        log_negative_cache_stats(negative_cache_.stats());
+        ulock.lock();
+
+        maintenance_wakeup_.wait_for(ulock, chrono::seconds(config_.blob_gc_interval_seconds),
+                            [this]() { return maintenance_stopping_; });
+    }
+}
+
+DbOpStatus SimpleDB::local_stat(const std::string& object_key,
+                            simpledb::proto::ObjectMetadata& metadata)
+{
+    return stat_object(leveldb::ReadOptions(), object_key, metadata);
+}
+
+DbOpStatus SimpleDB::local_get(const GetRequest& request, std::string& data)
+{
+    if (serve_cached(request, data))
+        return DbOpStatus::STATUS_OK;
+    if (known_missing(request))
+        return DbOpStatus::STATUS_NOTFOUND;
+
+    /* Metadata and content are separate records; read both from the
+     * same view so a concurrent overwrite cannot mix versions. */
+    const uint64_t epoch = delete_epoch_.load();
+    const uint64_t missing_epoch = put_epoch_.load();
+    leveldb::ReadOptions options;
+    options.snapshot = db->GetSnapshot();
+    DbOpStatus status;
+    try
+    {
+        status = read_object(options, epoch, request, data);
+    }
+    catch (...)
+    {
+        db->ReleaseSnapshot(options.snapshot);
+        throw;
+    }
+
+    db->ReleaseSnapshot(options.snapshot);
+    if (status == DbOpStatus::STATUS_NOTFOUND)
+        note_missing(request.object_key, request.exec, missing_epoch);
+    return status;
+}
+
+DbOpStatus SimpleDB::local_get_into(const GetRequest& request,
+                                const ContentAllocator& allocate)
+{
+    if (serve_cached(request, allocate))
+        return DbOpStatus::STATUS_OK;
+    if (known_missing(request))
+        return DbOpStatus::STATUS_NOTFOUND;
+
+    const uint64_t epoch = delete_epoch_.load();
+    const uint64_t missing_epoch = put_epoch_.load();
+    leveldb::ReadOptions options;
+    options.snapshot = db->GetSnapshot();
+
+    DbOpStatus status;
+    try
+    {
+        status = read_object_into(options, epoch, request, allocate);
+    }
+    catch (...)
+    {
+        db->ReleaseSnapshot(options.snapshot);
+        throw;
+    }
+
+    db->ReleaseSnapshot(options.snapshot);
+    if (status == DbOpStatus::STATUS_NOTFOUND)
+        note_missing(request.object_key, request.exec, missing_epoch);
+    return status;
+}
+
+std::mutex& SimpleDB::write_lock(const string& object_key)
+{
+    return write_locks_[crc16(object_key) % write_locks_.size()];
+}
+
+/* Stripes are taken in index order, each once */
+vector<unique_lock<mutex>> SimpleDB::lock_writes(const vector<const string*>& object_keys)
+{
+    vector<size_t> stripes;
+    for (const string* object_key : object_keys)
+        stripes.push_back(crc16(*object_key) % write_locks_.size());
+    sort(stripes.begin(), stripes.end());
+    stripes.erase(unique(stripes.begin(), stripes.end()), stripes.end());
+
+    vector<unique_lock<mutex>> locks;
+    for (const size_t stripe : stripes)
+        locks.emplace_back(write_locks_[stripe]);
+    return locks;
+}
+
+DbOpStatus SimpleDB::local_put(const PutRequest& request)
+{
+    const uint64_t epoch = delete_epoch_.load();
+    leveldb::WriteBatch batch;
+    vector<uint64_t> new_blobs;
+    unique_lock<mutex> ulock(write_lock(request.object_key));
+
+    DbOpStatus status = prepare_put(request, batch, new_blobs);
+    if (status != DbOpStatus::STATUS_OK)
+        return status;
+
+    leveldb::Status s = db->Write(write_options_, &batch);
+    ulock.unlock();
+    forget_missing(request.object_key);
+    if (!s.ok())
+    {
+        LOG(ERROR) << "Set Key=" << request.object_key << " Error: " << s.ToString();
+        discard_blobs(new_blobs);
+        return DbOpStatus::STATUS_IOERROR;
+    }
+
+    fill_local_cache(request, epoch);
+    return DbOpStatus::STATUS_OK;
+}
+
+DbOpStatus SimpleDB::local_del(const std::string& key)
+{
+    leveldb::WriteBatch batch;
+    unique_lock<mutex> ulock(write_lock(key));
+    remove_object(key, batch);
+
+    leveldb::Status s = db->Write(write_options_, &batch);
+    ulock.unlock();
+    invalidate_local_cache({key});
+    if (s.IsNotFound())
+    {
+        LOG(INFO) << "Remove Key=" << key << " Error: " << s.ToString();
+        return DbOpStatus::STATUS_NOTFOUND;
+    }
+    else if (!s.ok())
+    {
+        LOG(ERROR) << "Remove Key=" << key << " Error: " << s.ToString();
+        return DbOpStatus::STATUS_IOERROR;
+    }
+
+    return DbOpStatus::STATUS_OK;
+}
+
+void SimpleDB::local_multi_get(const vector<GetRequest>& requests,
+            const function<void(const GetRequest&,
+                                    const DbOpStatus,
+                                    const std::string&)>& callback)
+{
+    if (requests.empty())
+        return;
+
+    /* Every key is read from the same point-in-time view */
+    const uint64_t epoch = delete_epoch_.load();
+    const uint64_t missing_epoch = put_epoch_.load();
+    leveldb::ReadOptions options;
+    options.snapshot = db->GetSnapshot();
+
+    try
+    {
+        for (auto &req: requests)
+        {
+            string content;
+            DbOpStatus status;
+            if (serve_cached(req, content))
+            {
+                status = DbOpStatus::STATUS_OK;
+            }
+            else if (known_missing(req))
+            {
+                status = DbOpStatus::STATUS_NOTFOUND;
+            }
+            else
+            {
+                status = read_object(options, epoch, req, content);
+                if (status == DbOpStatus::STATUS_NOTFOUND)
+                    note_missing(req.object_key, req.exec, missing_epoch);
+            }
+            callback(req, status, content);
+        }
+    }
+    catch (...)
+    {
+        db->ReleaseSnapshot(options.snapshot);
+        throw;
+    }
+
+    db->ReleaseSnapshot(options.snapshot);
+}
+
+void SimpleDB::local_multi_get_into(const vector<GetRequest>& requests,
+            const ContentReserver& reserve,
+            const ContentAllocator& allocate,
+            const function<void(const GetRequest&,
+                                    const DbOpStatus)>& callback)
+{
+    if (requests.empty())
+        return;
+
+    const uint64_t epoch = delete_epoch_.load();
+    const uint64_t missing_epoch = put_epoch_.load();
+    leveldb::ReadOptions options;
+    options.snapshot = db->GetSnapshot();
+
+    /* Sized up front from the cache and the metadata, so that the
+     * caller can make room for all the values at once; the reads then
+     * reuse what was looked up. Stops within the byte budget of a
+     * multi op. */
+    struct Lookup
+    {
+        DbOpStatus status {DbOpStatus::STATUS_OK};
+        bool read {false};      /* stat_object was asked */
+        Cache::Value cached {};
+        simpledb::proto::ObjectMetadata metadata {};
+        simpledb::proto::FileMetadata legacy {};
+    };
+
+    try
+    {
+        vector<Lookup> lookups;
+        lookups.reserve(requests.size());
+        size_t value_bytes = 0;
+
+        for (auto &req: requests)
+        {
+            lookups.emplace_back();
+            Lookup& lookup = lookups.back();
+
+            if ((lookup.cached = cached_content(req)))
+            {
+                value_bytes += lookup.cached->length();
+            }
+            else if (known_missing(req))
+            {
+                lookup.status = DbOpStatus::STATUS_NOTFOUND;
+            }
+            else
+            {
+                lookup.read = true;
+                lookup.status = stat_object(options, req.object_key,
+                                            lookup.metadata, &lookup.legacy);
+                if (lookup.status == DbOpStatus::STATUS_OK
+                        && req.exec && !lookup.metadata.executable())
+                    lookup.status = DbOpStatus::STATUS_NOTFOUND;
+                if (lookup.status == DbOpStatus::STATUS_OK)
+                    value_bytes += lookup.metadata.size();
+            }
+
+            if (config_.multi_op_max_bytes > 0
+                    && value_bytes >= config_.multi_op_max_bytes)
+                break;
+        }
+
+        reserve(lookups.size(), value_bytes);
+
+        for (size_t idx = 0; idx < lookups.size(); idx++)
+        {
+            const GetRequest& req = requests[idx];
+            Lookup& lookup = lookups[idx];
+
+            if (lookup.cached)
+            {
+                serve_cached(req, lookup.cached, allocate);
+            }
+            else if (lookup.status == DbOpStatus::STATUS_OK)
+            {
+                lookup.status = req.filename.initialized()
+                    ? read_object_into(options, epoch, req, allocate)
+                    : read_content_into(options, epoch, req,
+                                        lookup.metadata, lookup.legacy, allocate);
+            }
+
+            if (lookup.read && lookup.status == DbOpStatus::STATUS_NOTFOUND)
+                note_missing(req.object_key, req.exec, missing_epoch);
+            callback(req, lookup.status);
+        }
+    }
+    catch (...)
+    {
+        db->ReleaseSnapshot(options.snapshot);
+        throw;
+    }
+
+    db->ReleaseSnapshot(options.snapshot);
+}
+
+void SimpleDB::local_multi_put(const vector<PutRequest>& requests,
+            const function<void(const PutRequest&,
+                                    const DbOpStatus)>& callback)
+{
+    if (requests.empty())
+        return;
+
+    const uint64_t epoch = delete_epoch_.load();
+    leveldb::WriteBatch batch;
+    vector<uint64_t> new_blobs;
+    vector<DbOpStatus> statuses(requests.size(), DbOpStatus::STATUS_OK);
+    unordered_set<string> immutable_keys;
+
+    /* Only the last put of a key in the batch is prepared: each would
+     * see the same metadata, and all but the last blob would be left
+     * unnamed. The others share its outcome. */
+    const size_t none = requests.size();
+    vector<size_t> superseded_by(requests.size(), none);
+    unordered_map<string, size_t> last_put;
+    vector<const string*> keys;
+
+    for (size_t idx = 0; idx < requests.size(); idx++)
+    {
+        auto &req = requests[idx];
+
+        /* An earlier request in this batch may already have made the key
+         * immutable; LevelDB cannot tell us until the batch is applied. */
+        if (immutable_keys.count(req.object_key))
+        {
+            statuses[idx] = DbOpStatus::STATUS_IMMUTABLE;
+            continue;
+        }
+
+        auto it = last_put.find(req.object_key);
+        if (it != last_put.end())
+            superseded_by[it->second] = idx;
+        last_put[req.object_key] = idx;
+        keys.push_back(&req.object_key);
+
+        if (req.immutable)
+            immutable_keys.insert(req.object_key);
+    }
+
+    auto locks = lock_writes(keys);
+    for (size_t idx = 0; idx < requests.size(); idx++)
+    {
+        if (statuses[idx] == DbOpStatus::STATUS_OK && superseded_by[idx] == none)
+            statuses[idx] = prepare_put(requests[idx], batch, new_blobs);
+    }
+
+    leveldb::Status s = db->Write(write_options_, &batch);
+    locks.clear();
+
+    for (size_t idx = requests.size(); idx-- > 0;)
+    {
+        if (superseded_by[idx] != none)
+            statuses[idx] = statuses[superseded_by[idx]];
+    }
+    for (size_t idx = 0; idx < requests.size(); idx++)
+    {
+        if (statuses[idx] == DbOpStatus::STATUS_OK)
+            forget_missing(requests[idx].object_key);
+    }
+
+    if (!s.ok())
+    {
+        LOG(ERROR) << "Set batch of " << requests.size() << " keys Error: " << s.ToString();
+        discard_blobs(new_blobs);
+        for (auto &status: statuses)
+        {
+            if (status == DbOpStatus::STATUS_OK)
+                status = DbOpStatus::STATUS_IOERROR;
+        }
+    }
+
+    for (size_t idx = 0; idx < requests.size(); idx++)
+    {
+        if (statuses[idx] == DbOpStatus::STATUS_OK)
+            fill_local_cache(requests[idx], epoch);
+        callback(requests[idx], statuses[idx]);
+    }
+}
+
+void SimpleDB::local_multi_del(const vector<string>& object_keys,
+            const function<void(const string&,
+                                    const DbOpStatus)>& callback)
+{
+    if (object_keys.empty())
+        return;
+
+    leveldb::WriteBatch batch;
+    vector<const string*> keys;
+    for (auto &key: object_keys)
+        keys.push_back(&key);
+
+    auto locks = lock_writes(keys);
+    for (auto &key: object_keys)
+        remove_object(key, batch);
+
+    auto status = DbOpStatus::STATUS_OK;
+    leveldb::Status s = db->Write(write_options_, &batch);
+    locks.clear();
+    invalidate_local_cache(object_keys);
+    if (!s.ok())
+    {
+        LOG(ERROR) << "Remove batch of " << object_keys.size() << " keys Error: " << s.ToString();
+        status = DbOpStatus::STATUS_IOERROR;
+    }
+
+    for (auto &key: object_keys)
+        callback(key, status);
+}
@@ -2,17 +2,33 @@
 #define SIMPLEDB_DB_H
 
 #include <string>
-#include <deque>
+#include <memory>
+#include <array>
+#include <vector>
+#include <unordered_set>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
 
 #include "leveldb/db.h"
 #include "leveldb/cache.h"
+#include "leveldb/write_batch.h"
 
 #include "config.h"
+#include "formats/serialization.pb.h"
 #include "util/path.h"
 #include "util/optional.h"
-#include "net/socket.h"
+#include "util/single_flight.h"
 #include "net/address.h"
+#include "net/connection_pool.h"
+#include "net/remote_client.h"
 #include "storage/cache.h"
+#include "storage/blob_store.h"
+#include "storage/negative_cache.h"
+#include "storage/disk_cache.h"
+#include "storage/content_store.h"
 
 namespace simpledb::storage
 {
@@ -25,6 +41,11 @@ namespace simpledb::storage
         STATUS_INVALID
     };
 
+    /* With `filename` set the object is written to that file, linked
+     * or copied file-to-file where possible, and the data handed back
+     * may be empty (so for blobs read locally, objects linked from the
+     * object store, and gets that waited on another caller writing the
+     * same file). */
     struct GetRequest
     {
         std::string object_key;
@@ -43,6 +64,18 @@ namespace simpledb::storage
                 mode(true, mode), exec(exec) {}
     };
 
+    /* Zero-copy reads: called once with the content length, returns
+     * where the content is to be copied, e.g. straight into an outgoing
+     * response buffer. The content is copied there exactly once.
+     * `immutable` tells whether the object may be kept by whoever asked. */
+    typedef std::function<char*(const GetRequest&, const size_t length,
+                                const bool immutable)> ContentAllocator;
+
+    /* Called before a batch of such reads with how many there are and
+     * the total length of their content, to make room at once */
+    typedef std::function<void(const size_t count,
+                                const size_t length)> ContentReserver;
+
     struct PutRequest
     {
         std::string object_key;
@@ -74,13 +107,62 @@ namespace simpledb::storage
         unsigned replica_idx {0};
         unsigned int conn_timeout_seconds { 5 };
         unsigned int conn_max_retry { 32 };
+        unsigned int max_idle_connections { 8 };    /* per replica */
 
         roost::path db_;
         bool create_if_not_exists { true };
         size_t backend_cache_size;
         size_t immutable_cache_size;
+        size_t immutable_cache_shards {0};      /* 0: sized from the core count */
+        CachePolicy immutable_cache_policy {CachePolicy::LRU};
+
+        /* Server side: content of immutable objects in this replica's
+         * shard, served to local gets without reading LevelDB (0: off) */
+        size_t local_cache_size {64 * 1024 * 1024};
+        CachePolicy local_cache_policy {CachePolicy::LRU};
+
+        /* Keys found missing, answered NOTFOUND without another lookup
+         * (0: off). Local misses are kept until the key is written;
+         * misses reported by other replicas expire after the TTL, as
+         * their writes are not seen here (0: not kept). */
+        size_t negative_cache_entries {64 * 1024};
+        unsigned int remote_negative_ttl_ms {1000};
+
+        /* Executables and file arguments materialized for executions
+         * under db_/cache, evicted once they take more than this */
+        size_t exec_cache_size {8ul * 1024 * 1024 * 1024};
+        DiskCache::Policy exec_cache_policy {DiskCache::Policy::LRU};
+
+        /* Functions, by key, that the operator trusts to run inside the
+         * server as shared objects (see cpplambda.h). Any other function
+         * runs in a process of its own, whatever it is named. */
+        std::unordered_set<std::string> inprocess_functions {};
+
+        /* Local writes are synchronous; concurrent ones share an fsync
+         * as LevelDB applies queued writers as one group */
+        bool sync_writes { false };
 
-        size_t max_batch_size {32};
+        /* Remote pipelining: requests and bytes (in flight plus received
+         * but not yet consumed) allowed outstanding per replica and call */
+        size_t pipeline_depth {32};
+        size_t pipeline_bytes {64 * 1024 * 1024};
+
+        /* Keys (and, where known up front, payload bytes) coalesced into
+         * a single Multi{Get,Put,Delete}Request on the wire */
+        size_t multi_op_max_keys {32};
+        size_t multi_op_max_bytes {4 * 1024 * 1024};
+
+        /* Values of at least blob_min_size bytes (0: never) are stored
+         * as files under db_/blobs instead of inside LevelDB. Files of
+         * deleted or overwritten blobs are collected every
+         * blob_gc_interval_seconds, once they have been dead that long. */
+        size_t blob_min_size {1024 * 1024};
+        unsigned int blob_gc_interval_seconds {30};
+
+        /* Immutable objects once written to a file are kept under
+         * db_/objects, up to this many bytes, and later written to other
+         * files by linking (0: off) */
+        size_t object_store_size {4ul * 1024 * 1024 * 1024};
 
         SimpleDBConfig(): address_(0), db_("") {}
     };
@@ -90,21 +172,130 @@ namespace simpledb::storage
     private:
         SimpleDBConfig config_;
         leveldb::DB *db;
-        std::deque<TCPSocket*> conns_;
-        bool init { false };
+        leveldb::WriteOptions write_options_;
+        std::vector<std::unique_ptr<ConnectionPool>> pools_;
+        RemoteClient remote_;
         Cache immutable_object_cache_;
+        std::unique_ptr<BlobStore> blobs_;
+        std::unique_ptr<ContentStore> objects_;
+
+        /* Concurrent gets of the same remote key, or of local objects
+         * into the same file, wait for a single fetch */
+        struct FetchResult
+        {
+            DbOpStatus status {DbOpStatus::STATUS_IOERROR};
+            Cache::Value content {};
+            bool immutable {false};
+        };
+        SingleFlight<FetchResult> fetches_;
+        SingleFlight<FetchResult> materializations_;
+
+        /* Bumped after every committed delete; a cache fill that raced
+         * with one is undone (see fill_local_cache) */
+        Cache local_object_cache_;
+        std::atomic<uint64_t> delete_epoch_ {0};
+
+        /* Bumped after every put; a miss recorded across one is undone
+         * (see note_missing) */
+        NegativeCache negative_cache_;
+        std::atomic<uint64_t> put_epoch_ {0};
+
+        /* A write of a key holds its stripe from reading the metadata to
+         * committing, so that the blob it replaces is still the one it
+         * saw and no blob it wrote is left unnamed */
+        std::array<std::mutex, 64> write_locks_;
 
-        void connect();
+        /* Collects blobs and logs cache hit rates every
+         * blob_gc_interval_seconds */
+        std::mutex maintenance_lock_;
+        std::condition_variable maintenance_wakeup_;
+        bool maintenance_stopping_ {false};
+        std::thread maintenance_thread_;
+
+        DbOpStatus stat_object(const leveldb::ReadOptions& options,
+            const std::string& object_key,
+            simpledb::proto::ObjectMetadata& metadata,
+            simpledb::proto::FileMetadata* legacy = nullptr);
+        DbOpStatus read_object(const leveldb::ReadOptions& options,
+            const uint64_t epoch, const GetRequest& request, std::string& data,
+            bool* immutable = nullptr);
+        DbOpStatus read_object_into(const leveldb::ReadOptions& options,
+            const uint64_t epoch, const GetRequest& request,
+            const ContentAllocator& allocate);
+        DbOpStatus read_content_into(const leveldb::ReadOptions& options,
+            const uint64_t epoch, const GetRequest& request,
+            const simpledb::proto::ObjectMetadata& metadata,
+            const simpledb::proto::FileMetadata& legacy,
+            const ContentAllocator& allocate);
+        DbOpStatus prepare_put(const PutRequest& request, leveldb::WriteBatch& batch,
+            std::vector<uint64_t>& new_blobs);
+        void remove_object(const std::string& object_key, leveldb::WriteBatch& batch);
+        std::mutex& write_lock(const std::string& object_key);
+        std::vector<std::unique_lock<std::mutex>> lock_writes(
+            const std::vector<const std::string*>& object_keys);
+        void materialize(const GetRequest& request, const std::string& data,
+            const bool immutable);
+        bool materialize_stored(const GetRequest& request);
+        void forget_stored(const std::string& object_key);
+        void discard_blobs(const std::vector<uint64_t>& blob_ids);
+
+        Cache::Value cached_content(const GetRequest& request);
+        bool serve_cached(const GetRequest& request, std::string& data);
+        bool serve_cached(const GetRequest& request, const ContentAllocator& allocate);
+        void serve_cached(const GetRequest& request, const Cache::Value& cached,
+            const ContentAllocator& allocate);
+        void fill_local_cache(const std::string& object_key,
+            Cache::Value content, const uint64_t epoch);
+        void fill_local_cache(const PutRequest& request, const uint64_t epoch);
+        void invalidate_local_cache(const std::vector<std::string>& object_keys);
+
+        bool known_missing(const GetRequest& request);
+        void note_missing(const std::string& object_key, const bool exec_only,
+            const uint64_t epoch, const std::chrono::milliseconds ttl
+                                    = std::chrono::milliseconds(0));
+        void forget_missing(const std::string& object_key);
+
+        void collect_garbage(const bool sweep_preexisting);
+        void run_maintenance();
 
     public:
         SimpleDB(const SimpleDBConfig& config);
-        ~SimpleDB() {}
+        ~SimpleDB();
 
+        Cache::Stats immutable_cache_stats() const { return immutable_object_cache_.stats(); }
+        Cache::Stats local_cache_stats() const { return local_object_cache_.stats(); }
+        NegativeCache::Stats negative_cache_stats() const { return negative_cache_.stats(); }
+
+        DbOpStatus local_stat(const std::string& object_key,
+            simpledb::proto::ObjectMetadata& metadata);
         DbOpStatus local_get(const GetRequest& request,
             std::string& data);
+        DbOpStatus local_get_into(const GetRequest& request,
+            const ContentAllocator& allocate);
         DbOpStatus local_put(const PutRequest& request);
         DbOpStatus local_del(const std::string& object_key);
 
+        /* Batched local operations: gets share one snapshot, puts and
+         * deletes are applied as a single atomic WriteBatch. Gets into
+         * buffers stop once multi_op_max_bytes of values are served
+         * (always serving at least one), the callback not being called
+         * for the remaining requests. */
+        void local_multi_get(const std::vector<GetRequest>& requests,
+            const std::function<void(const GetRequest&,
+                                    const DbOpStatus,
+                                    const std::string&)>& callback);
+        void local_multi_get_into(const std::vector<GetRequest>& requests,
+            const ContentReserver& reserve,
+            const ContentAllocator& allocate,
+            const std::function<void(const GetRequest&,
+                                    const DbOpStatus)>& callback);
+        void local_multi_put(const std::vector<PutRequest>& requests,
+            const std::function<void(const PutRequest&,
+                                    const DbOpStatus)>& callback);
+        void local_multi_del(const std::vector<std::string>& object_keys,
+            const std::function<void(const std::string&,
+                                    const DbOpStatus)>& callback);
+
         void get(std::vector<GetRequest>& download_requests,
             const std::function<void(const GetRequest&,
                                     const DbOpStatus,
@@ -118,6 +309,13 @@ namespace simpledb::storage
                                     const DbOpStatus)>& callback
                         = [](const PutRequest&, const DbOpStatus){});
 
+        /* Whether each key exists, and if so its metadata (blob_id
+         * left out), asking the replicas that hold them */
+        void stat(const std::vector<std::string>& object_keys,
+            const std::function<void(const std::string&,
+                                    const DbOpStatus,
+                                    const simpledb::proto::ObjectMetadata&)>& callback);
+
         void del(const std::vector<std::string>& object_keys,
             const std::function<void(const std::string&,
                                     const DbOpStatus)>& callback
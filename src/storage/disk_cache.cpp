@@ -0,0 +1,194 @@
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <glog/logging.h>
+
+#include "storage/disk_cache.h"
+#include "util/exception.h"
+
+using namespace std;
+using namespace simpledb::storage;
+
+DiskCache::DiskCache(const roost::path& dir, const size_t capacity, const Policy policy)
+    : dir_(dir), capacity_(capacity), policy_(policy)
+{
+    roost::create_directories(dir_);
+
+    /* Rebuild the index, oldest files first so that they go first */
+    vector<pair<time_t, string>> found;
+    for (const auto& name : roost::get_directory_listing(dir_))
+    {
+        struct stat info;
+        if (lstat(path_of(name).string().c_str(), &info) < 0 || !S_ISREG(info.st_mode))
+            continue;
+
+        found.emplace_back(info.st_mtime, name);
+        entries_[name].size = info.st_size;
+    }
+
+    sort(found.begin(), found.end());
+    for (const auto& file : found)
+    {
+        Entry& entry = entries_[file.second];
+        entry.last_access = ++clock_;
+        entry.rank = rank_of(entry);
+        evictable_.emplace(entry.rank, file.second);
+        size_ += entry.size;
+    }
+
+    const lock_guard<mutex> lguard(lock_);
+    evict();
+
+    LOG(INFO) << "Disk cache " << dir_.string() << ": " << entries_.size()
+            << " files, " << size_ << "/" << capacity_ << " bytes";
+}
+
+DiskCache::Rank DiskCache::rank_of(const Entry& entry) const
+{
+    if (policy_ == Policy::LFU)
+        return {entry.accesses, entry.last_access};
+
+    return {entry.last_access, 0};
+}
+
+void DiskCache::touch(Entry& entry)
+{
+    entry.accesses++;
+    entry.last_access = ++clock_;
+}
+
+void DiskCache::pin(const string& name, Entry& entry)
+{
+    if (entry.pins++ > 0)
+        return;
+
+    /* Entries just created by insert were never evictable */
+    auto it = evictable_.find(entry.rank);
+    if (it != evictable_.end() && it->second == name)
+        evictable_.erase(it);
+    pinned_size_ += entry.size;
+}
+
+void DiskCache::evict()
+{
+    while (size_ > capacity_ && !evictable_.empty())
+    {
+        auto victim = evictable_.begin();
+        const string name = victim->second;
+        evictable_.erase(victim);
+
+        auto it = entries_.find(name);
+        size_ -= it->second.size;
+        entries_.erase(it);
+        evictions_++;
+
+        const string path = path_of(name).string();
+        if (unlink(path.c_str()) < 0 && errno != ENOENT)
+            LOG(ERROR) << "Failed to evict " << path << ": " << strerror(errno);
+    }
+}
+
+bool DiskCache::acquire(const string& name)
+{
+    const lock_guard<mutex> lguard(lock_);
+
+    auto it = entries_.find(name);
+    if (it == entries_.end())
+    {
+        misses_++;
+        return false;
+    }
+
+    hits_++;
+    pin(name, it->second);
+    touch(it->second);
+    return true;
+}
+
+void DiskCache::insert(const string& name)
+{
+    const uint64_t size = roost::file_size(path_of(name));
+
+    const lock_guard<mutex> lguard(lock_);
+
+    /* Someone else may have fetched the same file meanwhile */
+    Entry& entry = entries_[name];
+    pin(name, entry);
+    touch(entry);
+
+    size_ += size;
+    size_ -= entry.size;
+    pinned_size_ += size;
+    pinned_size_ -= entry.size;
+    entry.size = size;
+
+    evict();
+}
+
+void DiskCache::release(const vector<string>& names)
+{
+    const lock_guard<mutex> lguard(lock_);
+
+    for (const auto& name : names)
+    {
+        auto it = entries_.find(name);
+        if (it == entries_.end() || it->second.pins == 0)
+            continue;
+
+        Entry& entry = it->second;
+        if (--entry.pins > 0)
+            continue;
+
+        pinned_size_ -= entry.size;
+        entry.rank = rank_of(entry);
+        evictable_.emplace(entry.rank, name);
+    }
+
+    evict();
+}
+
+void DiskCache::remove(const string& name)
+{
+    const lock_guard<mutex> lguard(lock_);
+
+    auto it = entries_.find(name);
+    if (it != entries_.end())
+    {
+        Entry& entry = it->second;
+        if (entry.pins > 0)
+        {
+            pinned_size_ -= entry.size;
+        }
+        else
+        {
+            evictable_.erase(entry.rank);
+        }
+
+        size_ -= entry.size;
+        entries_.erase(it);
+    }
+
+    const string path = path_of(name).string();
+    if (unlink(path.c_str()) < 0 && errno != ENOENT)
+        LOG(ERROR) << "Failed to remove " << path << ": " << strerror(errno);
+}
+
+DiskCache::Stats DiskCache::stats() const
+{
+    const lock_guard<mutex> lguard(lock_);
+
+    Stats stats;
+    stats.capacity = capacity_;
+    stats.resident_bytes = size_;
+    stats.pinned_bytes = pinned_size_;
+    stats.entries = entries_.size();
+    stats.hits = hits_;
+    stats.misses = misses_;
+    stats.evictions = evictions_;
+    return stats;
+}
@@ -0,0 +1,100 @@
+#ifndef SIMPLEDB_DISK_CACHE_H
+#define SIMPLEDB_DISK_CACHE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <unordered_map>
+
+#include "util/path.h"
+
+namespace simpledb::storage
+{
+    /* Files under one directory (such as those materialized for
+     * executions), kept within a byte budget. The index lives in
+     * memory, rebuilt from a directory scan when opened, so checking
+     * for a file costs no system call.
+     * Files in use by a running execution are pinned and never evicted;
+     * when everything else is gone the budget may be overshot. */
+    class DiskCache
+    {
+    public:
+        enum class Policy
+        {
+            LRU,
+            LFU     /* least accesses first, least recent among equals */
+        };
+
+        struct Stats
+        {
+            size_t capacity {0};
+            size_t resident_bytes {0};
+            size_t pinned_bytes {0};
+            size_t entries {0};
+            uint64_t hits {0};
+            uint64_t misses {0};
+            uint64_t evictions {0};
+        };
+
+    private:
+        typedef std::pair<uint64_t, uint64_t> Rank;     /* lowest goes first */
+
+        struct Entry
+        {
+            uint64_t size {0};
+            uint64_t accesses {0};
+            uint64_t last_access {0};
+            unsigned pins {0};
+            Rank rank {};
+        };
+
+        const roost::path dir_;
+        const size_t capacity_;
+        const Policy policy_;
+
+        mutable std::mutex lock_;
+        std::unordered_map<std::string, Entry> entries_;
+        std::map<Rank, std::string> evictable_;     /* unpinned entries */
+        uint64_t clock_ {0};
+        size_t size_ {0};
+        size_t pinned_size_ {0};
+
+        uint64_t hits_ {0};
+        uint64_t misses_ {0};
+        uint64_t evictions_ {0};
+
+        Rank rank_of(const Entry& entry) const;
+        void touch(Entry& entry);
+        void pin(const std::string& name, Entry& entry);
+        void evict();
+
+    public:
+        DiskCache(const roost::path& dir, const size_t capacity,
+                    const Policy policy = Policy::LRU);
+
+        DiskCache(const DiskCache&) = delete;
+        DiskCache& operator=(const DiskCache&) = delete;
+
+        const roost::path& dir() const { return dir_; }
+        roost::path path_of(const std::string& name) const { return dir_ / name; }
+        Stats stats() const;
+
+        /* Pins `name` if it is cached; false if it has to be fetched */
+        bool acquire(const std::string& name);
+
+        /* Records a file just written under dir(), pinned, and evicts
+         * unpinned files until the budget is met again */
+        void insert(const std::string& name);
+
+        /* Drops one pin per name, taken by acquire or insert */
+        void release(const std::vector<std::string>& names);
+
+        /* Deletes the file now, pinned or not; outstanding pins of it
+         * are ignored when released */
+        void remove(const std::string& name);
+    };
+}
+
+#endif /* SIMPLEDB_DISK_CACHE_H */
@@ -0,0 +1,129 @@
+#include <functional>
+
+#include "storage/negative_cache.h"
+
+using namespace std;
+using namespace simpledb::storage;
+
+NegativeCache::NegativeCache(const size_t capacity)
+    : capacity_(capacity), shard_capacity_((capacity + SHARDS - 1) / SHARDS),
+        shards_(make_unique<Shard[]>(SHARDS))
+{
+}
+
+NegativeCache::Shard& NegativeCache::shard_for(const string& key)
+{
+    const uint64_t hash = std::hash<string>()(key);
+    return shards_[(hash * 0x9E3779B97F4A7C15ull) >> 60];
+}
+
+bool NegativeCache::contains(const string& key, const bool exec)
+{
+    if (capacity_ == 0)
+        return false;
+
+    Shard& shard = shard_for(key);
+    const lock_guard<mutex> lguard(shard.lock);
+
+    auto it = shard.lookup.find(key);
+    if (it == shard.lookup.end())
+    {
+        shard.misses++;
+        return false;
+    }
+
+    auto entry = it->second;
+    if (entry->expires <= Clock::now())
+    {
+        shard.lookup.erase(it);
+        shard.lru.erase(entry);
+        shard.expirations++;
+        shard.misses++;
+        return false;
+    }
+
+    /* Present but not executable: only exec lookups fail */
+    if (entry->exec_only && !exec)
+    {
+        shard.misses++;
+        return false;
+    }
+
+    shard.lru.splice(shard.lru.begin(), shard.lru, entry);
+    shard.hits++;
+    return true;
+}
+
+void NegativeCache::insert(const string& key, const bool exec_only,
+                        const chrono::milliseconds ttl)
+{
+    if (capacity_ == 0)
+        return;
+
+    const auto expires = (ttl.count() > 0)
+                    ? Clock::now() + ttl
+                    : Clock::time_point::max();
+
+    Shard& shard = shard_for(key);
+    const lock_guard<mutex> lguard(shard.lock);
+
+    auto it = shard.lookup.find(key);
+    if (it != shard.lookup.end())
+    {
+        auto entry = it->second;
+        entry->exec_only = exec_only;
+        entry->expires = expires;
+        shard.lru.splice(shard.lru.begin(), shard.lru, entry);
+        return;
+    }
+
+    while (!shard.lru.empty() && shard.lru.size() >= shard_capacity_)
+    {
+        shard.lookup.erase(shard.lru.back().key);
+        shard.lru.pop_back();
+        shard.evictions++;
+    }
+
+    shard.lru.push_front({key, exec_only, expires});
+    shard.lookup.emplace(key, shard.lru.begin());
+    shard.inserts++;
+}
+
+void NegativeCache::drop(const string& key)
+{
+    if (capacity_ == 0)
+        return;
+
+    Shard& shard = shard_for(key);
+    const lock_guard<mutex> lguard(shard.lock);
+
+    auto it = shard.lookup.find(key);
+    if (it == shard.lookup.end())
+        return;
+
+    shard.lru.erase(it->second);
+    shard.lookup.erase(it);
+    shard.invalidations++;
+}
+
+NegativeCache::Stats NegativeCache::stats() const
+{
+    Stats stats;
+    stats.capacity = capacity_;
+
+    for (size_t idx = 0; idx < SHARDS; idx++)
+    {
+        Shard& shard = shards_[idx];
+        const lock_guard<mutex> lguard(shard.lock);
+
+        stats.entries += shard.lru.size();
+        stats.hits += shard.hits;
+        stats.misses += shard.misses;
+        stats.inserts += shard.inserts;
+        stats.evictions += shard.evictions;
+        stats.invalidations += shard.invalidations;
+        stats.expirations += shard.expirations;
+    }
+
+    return stats;
+}
@@ -0,0 +1,86 @@
+#ifndef SIMPLEDB_NEGATIVE_CACHE_HH
+#define SIMPLEDB_NEGATIVE_CACHE_HH
+
+#include <string>
+#include <list>
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <unordered_map>
+
+namespace simpledb::storage
+{
+    /* Keys recently found missing, so that repeated probes are answered
+     * NOTFOUND without a LevelDB lookup or a round trip. A key is either
+     * absent altogether or present but not executable, in which case only
+     * exec lookups are short-circuited. Bounded by a number of entries,
+     * evicted in LRU order; entries may also carry a time to live. Owners
+     * must drop a key whenever it is written. */
+    class NegativeCache
+    {
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+        struct Stats
+        {
+            size_t capacity {0};
+            size_t entries {0};
+            uint64_t hits {0};
+            uint64_t misses {0};
+            uint64_t inserts {0};
+            uint64_t evictions {0};
+            uint64_t invalidations {0};
+            uint64_t expirations {0};
+        };
+
+    private:
+        struct Entry
+        {
+            std::string key;
+            bool exec_only;
+            Clock::time_point expires;      /* max(): never */
+        };
+
+        typedef std::list<Entry> LRUList;
+
+        struct alignas(64) Shard
+        {
+            std::mutex lock;
+            LRUList lru;
+            std::unordered_map<std::string, LRUList::iterator> lookup;
+
+            uint64_t hits {0};
+            uint64_t misses {0};
+            uint64_t inserts {0};
+            uint64_t evictions {0};
+            uint64_t invalidations {0};
+            uint64_t expirations {0};
+        };
+
+        static constexpr size_t SHARDS = 16;
+
+        const size_t capacity_;
+        const size_t shard_capacity_;
+        std::unique_ptr<Shard[]> shards_;
+
+        Shard& shard_for(const std::string& key);
+
+    public:
+        NegativeCache(const size_t capacity);
+        ~NegativeCache() {}
+
+        size_t capacity() const { return capacity_; }
+        Stats stats() const;
+
+        /* True if a lookup of `key` (with the exec flag as given) is
+         * known to come back NOTFOUND */
+        bool contains(const std::string& key, const bool exec);
+
+        /* `ttl` of zero: the entry lives until dropped or evicted */
+        void insert(const std::string& key, const bool exec_only,
+                    const std::chrono::milliseconds ttl = std::chrono::milliseconds(0));
+        void drop(const std::string& key);
+    };
+}
+
+#endif /* SIMPLEDB_NEGATIVE_CACHE_HH */
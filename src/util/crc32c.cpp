@@ -0,0 +1,38 @@
+#include <array>
+
+#include "crc32c.h"
+
+using namespace std;
+
+static array<uint32_t, 256> make_crc32c_table()
+{
+    array<uint32_t, 256> table;
+
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? (0x82F63B78 ^ (c >> 1)) : (c >> 1);
+        table[n] = c;
+    }
+
+    return table;
+}
+
+uint32_t crc32c(const char* data, const size_t len, const uint32_t crc)
+{
+    static const array<uint32_t, 256> crc32ctab = make_crc32c_table();
+
+    uint32_t c = ~crc;
+    const uint8_t* s = (const uint8_t*) data;
+
+    for (size_t counter = 0; counter < len; counter++)
+        c = crc32ctab[(c ^ *s++) & 0xFF] ^ (c >> 8);
+
+    return ~c;
+}
+
+uint32_t crc32c(const string & buf)
+{
+    return crc32c(buf.data(), buf.length());
+}
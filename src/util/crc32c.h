@@ -0,0 +1,11 @@
+#ifndef CRC32C_HH
+#define CRC32C_HH
+
+#include <string>
+#include <cstdint>
+
+/* CRC-32C (Castagnoli). `crc` continues a previous computation. */
+uint32_t crc32c( const char* data, const size_t len, const uint32_t crc = 0 );
+uint32_t crc32c( const std::string& );
+
+#endif /* CRC32C_HH */
@@ -0,0 +1,138 @@
+#ifndef SIMPLEDB_SINGLE_FLIGHT_H
+#define SIMPLEDB_SINGLE_FLIGHT_H
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+
+/* Coalesces concurrent work on the same key: the first caller to join a
+ * key leads the flight and does the work, later callers wait for the
+ * leader's result instead of repeating it.
+ *
+ * Leaders must not wait on other flights before completing their own,
+ * or two callers leading each other's keys would deadlock; finish what
+ * you lead first, then wait. */
+template <class Result>
+class SingleFlight
+{
+public:
+    class Flight
+    {
+    private:
+        friend class SingleFlight;
+
+        std::mutex lock_;
+        std::condition_variable done_cv_;
+        bool done_ {false};
+        Result result_ {};
+
+    public:
+        const Result& wait()
+        {
+            std::unique_lock<std::mutex> ulock(lock_);
+            done_cv_.wait(ulock, [this]() { return done_; });
+            return result_;
+        }
+    };
+
+    /* Tracks the flights one caller leads. Whatever it has not completed
+     * by the time it goes out of scope (say, because an exception unwound
+     * the leader) is completed with `abandoned`, so no follower hangs. */
+    class Leader
+    {
+    private:
+        SingleFlight& group_;
+        const Result abandoned_;
+        std::unordered_map<std::string, std::shared_ptr<Flight>> led_ {};
+
+    public:
+        Leader(SingleFlight& group, const Result& abandoned)
+            : group_(group), abandoned_(abandoned) {}
+
+        ~Leader()
+        {
+            for (const auto& entry : led_)
+                group_.complete(entry.first, abandoned_);
+        }
+
+        Leader(const Leader&) = delete;
+        Leader& operator=(const Leader&) = delete;
+
+        /* True if the caller now leads `key`; otherwise `flight` is the
+         * flight to wait on, which may be one this caller leads itself. */
+        bool join(const std::string& key, std::shared_ptr<Flight>& flight)
+        {
+            auto it = led_.find(key);
+            if (it != led_.end())
+            {
+                flight = it->second;
+                return false;
+            }
+
+            if (!group_.join(key, flight))
+                return false;
+
+            led_.emplace(key, flight);
+            return true;
+        }
+
+        void complete(const std::string& key, const Result& result)
+        {
+            if (led_.erase(key))
+                group_.complete(key, result);
+        }
+    };
+
+private:
+    std::mutex lock_;
+    std::unordered_map<std::string, std::shared_ptr<Flight>> flights_;
+
+    bool join(const std::string& key, std::shared_ptr<Flight>& flight)
+    {
+        const std::lock_guard<std::mutex> lguard(lock_);
+
+        auto it = flights_.find(key);
+        if (it != flights_.end())
+        {
+            flight = it->second;
+            return false;
+        }
+
+        flight = std::make_shared<Flight>();
+        flights_.emplace(key, flight);
+        return true;
+    }
+
+    void complete(const std::string& key, const Result& result)
+    {
+        std::shared_ptr<Flight> flight;
+        {
+            const std::lock_guard<std::mutex> lguard(lock_);
+
+            auto it = flights_.find(key);
+            if (it == flights_.end())
+                return;
+
+            flight = std::move(it->second);
+            flights_.erase(it);
+        }
+
+        {
+            const std::lock_guard<std::mutex> lguard(flight->lock_);
+            flight->result_ = result;
+            flight->done_ = true;
+        }
+
+        flight->done_cv_.notify_all();
+    }
+
+public:
+    SingleFlight() {}
+
+    SingleFlight(const SingleFlight&) = delete;
+    SingleFlight& operator=(const SingleFlight&) = delete;
+};
+
+#endif /* SIMPLEDB_SINGLE_FLIGHT_H */
@@ -0,0 +1,108 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <thread>
+#include <random>
+#include <chrono>
+#include <atomic>
+#include <cstdlib>
+
+#include "storage/cache.h"
+
+using namespace std;
+using namespace std::chrono;
+using simpledb::storage::Cache;
+
+/* Throughput of Cache::access/insert as the number of threads grows,
+ * for the sharded cache against a single shard (i.e. one global lock).
+ * Usage: bench_cache.out [ops_per_thread] [value_size] [max_threads] */
+
+static const size_t KEY_SPACE = 1 << 16;
+static const unsigned INSERT_PERCENT = 10;
+
+static double run(Cache& cache, const vector<string>& keys, const Cache::Value& val,
+                    const unsigned threads, const size_t ops)
+{
+    atomic<bool> go {false};
+    vector<thread> workers;
+
+    for (unsigned t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&, t]()
+        {
+            mt19937_64 rng(t + 1);
+
+            while (!go.load()) {}
+
+            for (size_t i = 0; i < ops; i++)
+            {
+                const string& key = keys[rng() % keys.size()];
+                if (rng() % 100 < INSERT_PERCENT)
+                    cache.insert(key, val);
+                else
+                    cache.access(key);
+            }
+        });
+    }
+
+    const auto start = steady_clock::now();
+    go = true;
+    for (auto& worker : workers)
+        worker.join();
+    const double seconds = duration<double>(steady_clock::now() - start).count();
+
+    return (threads * ops) / seconds / 1e6;
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t ops = (argc > 1) ? strtoull(argv[1], nullptr, 10) : 1000000;
+    const size_t val_size = (argc > 2) ? strtoull(argv[2], nullptr, 10) : 64;
+    const unsigned max_threads = (argc > 3) ? atoi(argv[3])
+                                    : max(thread::hardware_concurrency(), 1u);
+
+    vector<string> keys;
+    for (size_t i = 0; i < KEY_SPACE; i++)
+        keys.push_back("key-" + to_string(i));
+    const auto val = make_shared<const string>(val_size, 'v');
+
+    /* Room for every key, so that the run measures locking, not eviction */
+    const size_t capacity = KEY_SPACE * (Cache::charge(keys.back(), *val) * 2);
+
+    cout << setw(8) << "threads"
+        << setw(16) << "1 shard Mops/s"
+        << setw(12) << "sharded"
+        << setw(10) << "shards" << endl;
+
+    for (unsigned threads = 1; threads <= max_threads; threads *= 2)
+    {
+        Cache single(capacity, 1);
+        Cache sharded(capacity, threads * 4);
+
+        for (auto& key : keys)
+        {
+            single.insert(key, val);
+            sharded.insert(key, val);
+        }
+
+        const double single_mops = run(single, keys, val, threads, ops);
+        const double sharded_mops = run(sharded, keys, val, threads, ops);
+
+        cout << setw(8) << threads
+            << setw(16) << fixed << setprecision(2) << single_mops
+            << setw(12) << sharded_mops
+            << setw(10) << sharded.shard_count() << endl;
+
+        if (threads * 2 > max_threads)
+        {
+            const auto stats = sharded.stats();
+            cout << "resident " << stats.resident_bytes << " of " << stats.capacity
+                << " bytes, " << stats.entries << " entries, "
+                << stats.evictions << " evictions, "
+                << stats.hits << " hits / " << stats.misses << " misses" << endl;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,135 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#include "storage/cache.h"
+
+using namespace std;
+using simpledb::storage::Cache;
+using simpledb::storage::CachePolicy;
+
+/* Hit ratio of the immutable object cache policies on a skewed trace:
+ * Zipf-distributed gets over a hot core of executables and shared
+ * inputs, interrupted by bursts of one-shot intermediate outputs that
+ * are inserted on upload and read back once.
+ * Usage: bench_cache_policy.out [ops] [zipf_exponent] [scan_length] */
+
+static const size_t HOT_OBJECTS = 4096;
+static const size_t MIN_OBJECT_SIZE = 1024;
+static const size_t MAX_OBJECT_SIZE = 64 * 1024;
+static const size_t SCAN_OBJECT_SIZE = 64 * 1024;
+static const size_t OPS_BETWEEN_SCANS = 20000;
+
+struct TraceOp
+{
+    size_t object;      /* index into the hot set, or SIZE_MAX for a scan */
+    uint64_t scan_id;
+};
+
+static vector<TraceOp> make_trace(const size_t ops, const double exponent,
+                                    const size_t scan_length)
+{
+    vector<double> cdf(HOT_OBJECTS);
+    double total = 0;
+    for (size_t i = 0; i < HOT_OBJECTS; i++)
+    {
+        total += 1.0 / pow(i + 1, exponent);
+        cdf[i] = total;
+    }
+
+    mt19937_64 rng(42);
+    uniform_real_distribution<double> uniform(0, total);
+    vector<TraceOp> trace;
+    uint64_t scan_id = 0;
+
+    while (trace.size() < ops)
+    {
+        for (size_t i = 0; i < OPS_BETWEEN_SCANS && trace.size() < ops; i++)
+        {
+            const size_t object = lower_bound(cdf.begin(), cdf.end(), uniform(rng)) - cdf.begin();
+            trace.push_back({min(object, HOT_OBJECTS - 1), 0});
+        }
+
+        for (size_t i = 0; i < scan_length && trace.size() < ops; i++)
+            trace.push_back({SIZE_MAX, scan_id++});
+    }
+
+    return trace;
+}
+
+static double replay(Cache& cache, const vector<TraceOp>& trace,
+                    const vector<string>& keys, const vector<Cache::Value>& values,
+                    const Cache::Value& scan_value)
+{
+    size_t hits = 0, gets = 0;
+
+    for (const auto& op : trace)
+    {
+        if (op.object == SIZE_MAX)
+        {
+            /* Immutable upload lands in the cache, then one consumer
+             * reads it; only the hot-set gets are scored */
+            const string key = "scan-" + to_string(op.scan_id);
+            cache.insert(key, scan_value);
+            cache.access(key);
+            continue;
+        }
+
+        gets++;
+        if (cache.access(keys[op.object]))
+            hits++;
+        else
+            cache.insert(keys[op.object], values[op.object]);
+    }
+
+    return 100.0 * hits / gets;
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t ops = (argc > 1) ? strtoull(argv[1], nullptr, 10) : 2000000;
+    const double exponent = (argc > 2) ? atof(argv[2]) : 0.9;
+    const size_t scan_length = (argc > 3) ? strtoull(argv[3], nullptr, 10) : 2000;
+
+    mt19937_64 rng(7);
+    vector<string> keys;
+    vector<Cache::Value> values;
+    size_t hot_bytes = 0;
+    for (size_t i = 0; i < HOT_OBJECTS; i++)
+    {
+        keys.push_back("object-" + to_string(i));
+        values.push_back(make_shared<const string>(
+            MIN_OBJECT_SIZE + rng() % (MAX_OBJECT_SIZE - MIN_OBJECT_SIZE), 'v'));
+        hot_bytes += Cache::charge(keys.back(), *values.back());
+    }
+    const auto scan_value = make_shared<const string>(SCAN_OBJECT_SIZE, 's');
+
+    const auto trace = make_trace(ops, exponent, scan_length);
+
+    cout << "hot set " << hot_bytes / (1024 * 1024) << " MB, zipf " << exponent
+        << ", " << scan_length << " one-shot objects every "
+        << OPS_BETWEEN_SCANS << " gets" << endl;
+    cout << setw(12) << "cache size" << setw(10) << "LRU %"
+        << setw(14) << "TinyLFU %" << endl;
+
+    for (const size_t percent : {5, 10, 25, 50})
+    {
+        const size_t capacity = hot_bytes * percent / 100;
+        Cache lru(capacity, 1, CachePolicy::LRU);
+        Cache tiny_lfu(capacity, 1, CachePolicy::TINY_LFU);
+
+        const double lru_ratio = replay(lru, trace, keys, values, scan_value);
+        const double tiny_lfu_ratio = replay(tiny_lfu, trace, keys, values, scan_value);
+
+        cout << setw(10) << percent << " %"
+            << setw(10) << fixed << setprecision(2) << lru_ratio
+            << setw(14) << tiny_lfu_ratio << endl;
+    }
+
+    return 0;
+}
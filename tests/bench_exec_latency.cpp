@@ -0,0 +1,302 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+
+#include "execution/cpplambda.h"
+#include "execution/shared_region.h"
+
+using namespace std;
+using namespace std::chrono;
+using namespace simpledb::proto;
+
+/* Latency of one function call in each execution mode. For a process
+ * spawned per call and one forked by a zygote, the time from asking
+ * for the process to the first byte of its response; for a warm
+ * process in persistent mode and a shared object called in process,
+ * the time per call. Built with -rdynamic so that the shared object
+ * resolves protobuf and formats against this binary.
+ * Usage: bench_exec_latency.out [calls] [function.out] [function.so] */
+
+typedef void (*LambdaEntry)(const ExecArgs& params, ExecResponse& resp);
+
+static const char* LAMBDA_EXEC_SYMBOL =
+        "_Z11lambda_execRKN8simpledb5proto8ExecArgsERNS0_12ExecResponseE";
+
+struct Child
+{
+    pid_t pid;
+    int input;      /* its stdin */
+    int output;     /* its stdout */
+};
+
+static Child spawn(const string& function, const bool persistent)
+{
+    int in[2], out[2];
+    if (pipe(in) < 0 || pipe(out) < 0)
+        throw runtime_error("pipe failed");
+
+    const pid_t pid = fork();
+    if (pid < 0)
+        throw runtime_error("fork failed");
+
+    if (pid == 0)
+    {
+        dup2(in[0], 0);
+        dup2(out[1], 1);
+        close(in[0]); close(in[1]);
+        close(out[0]); close(out[1]);
+
+        if (persistent)
+            execl(function.c_str(), function.c_str(), EXEC_PERSISTENT_FLAG, (char*) NULL);
+        else
+            execl(function.c_str(), function.c_str(), (char*) NULL);
+        _exit(127);
+    }
+
+    close(in[0]);
+    close(out[1]);
+    return {pid, in[1], out[0]};
+}
+
+static void write_all(const int fd, const string& data)
+{
+    size_t done = 0;
+    while (done < data.size())
+    {
+        const ssize_t n = write(fd, data.data() + done, data.size() - done);
+        if (n <= 0)
+            throw runtime_error("write failed");
+        done += n;
+    }
+}
+
+static void read_all(const int fd, char* data, const size_t len)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        const ssize_t n = read(fd, data + done, len - done);
+        if (n <= 0)
+            throw runtime_error("read failed");
+        done += n;
+    }
+}
+
+/* Returns when the first byte of the response arrived */
+static steady_clock::time_point call(const Child& child, const string& request,
+                                    ExecResponse& resp)
+{
+    write_all(child.input, request);
+
+    size_t len;
+    read_all(child.output, (char*) &len, 1);
+    const auto first_byte = steady_clock::now();
+    read_all(child.output, (char*) &len + 1, sizeof(size_t) - 1);
+    string buf(len, 0);
+    read_all(child.output, &buf[0], len);
+
+    if (!resp.ParseFromString(buf))
+        throw runtime_error("bad response");
+
+    return first_byte;
+}
+
+/* A worker forked by the zygote behind `control`, on its own sockets
+ * and shared regions */
+static Child fork_child(const int control, SharedRegion& args, SharedRegion& resp)
+{
+    int in[2], out[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, in) < 0
+            || socketpair(AF_UNIX, SOCK_STREAM, 0, out) < 0)
+        throw runtime_error("socketpair failed");
+
+    const int fds[EXEC_ZYGOTE_FDS] = { in[0], out[1], args.fd(), resp.fd() };
+    char request = 0;
+    struct iovec iov { &request, 1 };
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } cmsg_buf;
+
+    struct msghdr msg {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsg_buf.buf;
+    msg.msg_controllen = sizeof(cmsg_buf.buf);
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    pid_t pid;
+    if (sendmsg(control, &msg, 0) != 1)
+        throw runtime_error("sendmsg failed");
+    read_all(control, (char*) &pid, sizeof(pid_t));
+    if (pid < 0)
+        throw runtime_error("zygote failed to fork");
+
+    close(in[0]);
+    close(out[1]);
+
+    size_t hello;
+    read_all(out[0], (char*) &hello, sizeof(size_t));
+    if (hello != EXEC_SHARED_MEMORY_HELLO)
+        throw runtime_error("no hello from worker");
+
+    return {pid, in[1], out[0]};
+}
+
+static steady_clock::time_point call_shared(const Child& child, const ExecArgs& args,
+                        SharedRegion& args_region, SharedRegion& resp_region,
+                        ExecResponse& resp)
+{
+    size_t len = args.ByteSizeLong();
+    args.SerializeToArray(args_region.reserve(len), len);
+    write_all(child.input, string((char*) &len, sizeof(size_t)));
+
+    read_all(child.output, (char*) &len, 1);
+    const auto first_byte = steady_clock::now();
+    read_all(child.output, (char*) &len + 1, sizeof(size_t) - 1);
+
+    if (!resp.ParseFromArray(resp_region.view(len), len))
+        throw runtime_error("bad response");
+
+    return first_byte;
+}
+
+static void finish(const Child& child)
+{
+    close(child.input);
+    close(child.output);
+    waitpid(child.pid, nullptr, 0);
+}
+
+static void report(const string& mode, vector<double>& latencies)
+{
+    sort(latencies.begin(), latencies.end());
+    auto at = [&](const double q) { return latencies[(size_t) (q * (latencies.size() - 1))]; };
+
+    cout << setw(12) << left << mode << right << fixed << setprecision(1)
+        << setw(12) << at(0.5) << setw(12) << at(0.99) << endl;
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t calls = (argc > 1) ? strtoull(argv[1], nullptr, 10) : 1000;
+    const string binary = (argc > 2) ? argv[2] : "./lambda_fibonacci.out";
+    const string shared = (argc > 3) ? argv[3] : "./lambda_fibonacci.so";
+
+    ExecArgs args;
+    args.add_args("1");
+    args.add_args("2");
+
+    string request(sizeof(size_t), 0);
+    *((size_t*) &request[0]) = args.ByteSizeLong();
+    request.append(args.SerializeAsString());
+
+    ExecResponse resp;
+    vector<double> latencies;
+    latencies.reserve(calls);
+
+    cout << setw(12) << left << "mode" << right
+        << setw(12) << "p50 (us)" << setw(12) << "p99 (us)" << endl;
+
+    for (size_t i = 0; i < calls; i++)
+    {
+        const auto start = steady_clock::now();
+        const Child child = spawn(binary, false);
+        const auto first_byte = call(child, request, resp);
+        latencies.push_back(duration<double, micro>(first_byte - start).count());
+        finish(child);
+    }
+    report("spawn", latencies);
+
+    latencies.clear();
+    int control[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, control) < 0)
+        throw runtime_error("socketpair failed");
+
+    const pid_t zygote = fork();
+    if (zygote == 0)
+    {
+        dup2(control[1], 0);
+        close(control[0]);
+        close(control[1]);
+        execl(binary.c_str(), binary.c_str(), EXEC_ZYGOTE_FLAG, (char*) NULL);
+        _exit(127);
+    }
+    close(control[1]);
+
+    SharedRegion args_region { SharedRegion::create("bench-args") };
+    SharedRegion resp_region { SharedRegion::create("bench-response") };
+    for (size_t i = 0; i < calls; i++)
+    {
+        const auto start = steady_clock::now();
+        const Child child = fork_child(control[0], args_region, resp_region);
+        const auto first_byte = call_shared(child, args, args_region, resp_region, resp);
+        latencies.push_back(duration<double, micro>(first_byte - start).count());
+
+        /* Not our child: it exits on EOF and the zygote reaps it */
+        close(child.input);
+        close(child.output);
+    }
+    close(control[0]);
+    waitpid(zygote, nullptr, 0);
+    report("zygote", latencies);
+
+    latencies.clear();
+    const Child child = spawn(binary, true);
+    call(child, request, resp);     /* warm up */
+    for (size_t i = 0; i < calls; i++)
+    {
+        const auto start = steady_clock::now();
+        call(child, request, resp);
+        latencies.push_back(duration<double, micro>(steady_clock::now() - start).count());
+    }
+    finish(child);
+    report("persistent", latencies);
+
+    void* handle = dlopen(shared.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (handle == nullptr)
+    {
+        cerr << dlerror() << endl;
+        return 1;
+    }
+
+    auto entry = (LambdaEntry) dlsym(handle, LAMBDA_EXEC_SYMBOL);
+    if (entry == nullptr)
+    {
+        cerr << "No lambda_exec in " << shared << endl;
+        return 1;
+    }
+
+    latencies.clear();
+    for (size_t i = 0; i < calls; i++)
+    {
+        const auto start = steady_clock::now();
+        entry(args, resp);
+        latencies.push_back(duration<double, micro>(steady_clock::now() - start).count());
+    }
+    report("in-process", latencies);
+
+    if (resp.return_output() != "3")
+    {
+        cerr << "Unexpected output: " << resp.return_output() << endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -145,6 +145,55 @@ int main(int argc, char* argv[])
 
     std::cout << "GET key=" << key << " return_code=" << resp.return_code() << " value=" << resp.val() << std::endl;
 
+    /* Multi Set */
+    MultiPutRequest* mset_req = req.mutable_multi_put_request();
+    req.set_id(id++);
+    for (int i = 0; i < 4; i++)
+    {
+        PutRequest* put = mset_req->add_requests();
+        put->set_key(key + std::to_string(i));
+        put->set_val(value + std::to_string(i));
+    }
+
+    if (!send_request(fd, req))
+        return 1;
+
+    if (!receive_response(fd, resp))
+        return 1;
+
+    for (int i = 0; i < resp.results_size(); i++)
+        std::cout << "MSET key=" << key + std::to_string(i) << " return_code=" << resp.results(i).return_code() << std::endl;
+
+    /* Multi Get */
+    MultiGetRequest* mget_req = req.mutable_multi_get_request();
+    req.set_id(id++);
+    for (int i = 0; i < 5; i++)
+        mget_req->add_keys(key + std::to_string(i));
+
+    if (!send_request(fd, req))
+        return 1;
+
+    if (!receive_response(fd, resp))
+        return 1;
+
+    for (int i = 0; i < resp.results_size(); i++)
+        std::cout << "MGET key=" << mget_req->keys(i) << " return_code=" << resp.results(i).return_code() << " value=" << resp.results(i).val() << std::endl;
+
+    /* Multi Delete */
+    MultiDeleteRequest* mdel_req = req.mutable_multi_delete_request();
+    req.set_id(id++);
+    for (int i = 0; i < 4; i++)
+        mdel_req->add_keys(key + std::to_string(i));
+
+    if (!send_request(fd, req))
+        return 1;
+
+    if (!receive_response(fd, resp))
+        return 1;
+
+    for (int i = 0; i < resp.results_size(); i++)
+        std::cout << "MDEL key=" << mdel_req->keys(i) << " return_code=" << resp.results(i).return_code() << std::endl;
+
     /* Register */
     PutRequest* reg_req = req.mutable_put_request();
     req.set_id(id++);